@@ -1,57 +1,228 @@
 #include <iostream>
 #include <algorithm>
 #include <fstream>
-#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <new>
+#include <cmath>
+#include <filesystem>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "LibraryManagment.h"
 
 using namespace std;
 
 
+InternedString::InternedString(string_view text)
+    : data(text.empty() ? nullptr : StringPool::instance().intern(text)) {}
+
+string_view InternedString::view() const {
+    if (!data) return string_view();
+    uint32_t length;
+    memcpy(&length, data, sizeof(length));
+    return string_view(data + sizeof(length), length);
+}
+
+StringPool& StringPool::instance() {
+    static StringPool pool;
+    return pool;
+}
+
+// Returns the entry for text, copying it into the arena the first time it is
+// seen. The table's keys view the arena copies, so lookups need no allocation.
+const char* StringPool::intern(string_view text) {
+    lock_guard<mutex> guard(poolMutex);
+    auto it = entries.find(text);
+    if (it != entries.end()) return it->data() - sizeof(uint32_t);
+
+    uint32_t length = static_cast<uint32_t>(text.size());
+    char* entry = allocate(sizeof(length) + length);
+    memcpy(entry, &length, sizeof(length));
+    memcpy(entry + sizeof(length), text.data(), length);
+    entries.insert(string_view(entry + sizeof(length), length));
+    return entry;
+}
+
+// Bump allocation from the current block; strings too large for a block get
+// one of their own.
+char* StringPool::allocate(size_t size) {
+    if (size > BLOCK_SIZE / 4) {
+        blocks.push_back(make_unique<char[]>(size));
+        arenaBytes += size;
+        return blocks.back().get();
+    }
+    if (!block || blockUsed + size > BLOCK_SIZE) {
+        blocks.push_back(make_unique<char[]>(BLOCK_SIZE));
+        block = blocks.back().get();
+        blockUsed = 0;
+        arenaBytes += BLOCK_SIZE;
+    }
+    char* entry = block + blockUsed;
+    blockUsed += size;
+    return entry;
+}
+
+size_t StringPool::size() const {
+    lock_guard<mutex> guard(poolMutex);
+    return entries.size();
+}
+
+// Arena blocks plus an estimate of the table's buckets and nodes.
+size_t StringPool::bytes() const {
+    lock_guard<mutex> guard(poolMutex);
+    return arenaBytes + entries.bucket_count() * sizeof(void*) +
+           entries.size() * (sizeof(string_view) + 2 * sizeof(void*));
+}
+
+array<EntityPool::SizeClass, EntityPool::MAX_SIZE / EntityPool::GRANULE>& EntityPool::sizeClasses() {
+    static array<SizeClass, MAX_SIZE / GRANULE> classes;
+    return classes;
+}
+
+void* EntityPool::allocate(size_t size) {
+    if (size == 0 || size > MAX_SIZE) return ::operator new(size);
+    size_t rounded = (size + GRANULE - 1) / GRANULE * GRANULE;
+    SizeClass& sizeClass = sizeClasses()[rounded / GRANULE - 1];
+    lock_guard<mutex> guard(sizeClass.lock);
+    sizeClass.allocations++;
+    sizeClass.live++;
+    if (FreeNode* node = sizeClass.freeList) {
+        sizeClass.freeList = node->next;
+        sizeClass.reused++;
+        return node;
+    }
+    if (sizeClass.remaining < rounded) {
+        sizeClass.blocks.push_back(unique_ptr<char[]>(new char[BLOCK_SIZE]));
+        sizeClass.cursor = sizeClass.blocks.back().get();
+        sizeClass.remaining = BLOCK_SIZE;
+    }
+    void* object = sizeClass.cursor;
+    sizeClass.cursor += rounded;
+    sizeClass.remaining -= rounded;
+    return object;
+}
+
+void EntityPool::release(void* ptr, size_t size) {
+    if (!ptr) return;
+    if (size == 0 || size > MAX_SIZE) return ::operator delete(ptr);
+    size_t rounded = (size + GRANULE - 1) / GRANULE * GRANULE;
+    SizeClass& sizeClass = sizeClasses()[rounded / GRANULE - 1];
+    lock_guard<mutex> guard(sizeClass.lock);
+    sizeClass.live--;
+    sizeClass.freeList = new (ptr) FreeNode{sizeClass.freeList};
+}
+
+PoolStats EntityPool::stats() {
+    PoolStats total{};
+    for (SizeClass& sizeClass : sizeClasses()) {
+        lock_guard<mutex> guard(sizeClass.lock);
+        total.allocations += sizeClass.allocations;
+        total.reused += sizeClass.reused;
+        total.live += sizeClass.live;
+        total.blocks += sizeClass.blocks.size();
+    }
+    total.bytes = total.blocks * BLOCK_SIZE;
+    return total;
+}
+
 Book::Book(int id, const string& title, const string& author, 
            const string& publisher, int year, const string& isbn)
-    : bookID(id), title(title), author(author), publisher(publisher), 
-      year(year), ISBN(isbn), available(true) {}
+    : bookID(id), year(year), status(packStatus(BookState::Available, -1)), dirty(true),
+      author(author), publisher(publisher), title(title), ISBN(isbn) {}
+
+// Moving the list keeps its nodes, so the iterators in reservationPositions
+// stay valid.
+Book::Book(Book&& other) noexcept
+    : bookID(other.bookID), year(other.year), status(other.status.load()), dirty(other.dirty.load()),
+      reservationQueue(move(other.reservationQueue)), reservationPositions(move(other.reservationPositions)),
+      author(other.author), publisher(other.publisher), title(move(other.title)), ISBN(move(other.ISBN)) {}
 
 int Book::getBookID() const { return bookID; }
-string Book::getTitle() const { return title; }
-string Book::getAuthor() const { return author; }
-string Book::getPublisher() const { return publisher; }
+const string& Book::getTitle() const { return title; }
+string_view Book::getAuthor() const { return author.view(); }
+string_view Book::getPublisher() const { return publisher.view(); }
 int Book::getYear() const { return year; }
-string Book::getISBN() const { return ISBN; }
-bool Book::isAvailable() const { return available; }
-void Book::setAvailable(bool status) { available = status; }
+const string& Book::getISBN() const { return ISBN; }
+bool Book::isAvailable() const { return getState() == BookState::Available; }
+void Book::setAvailable(bool status) {
+    setState(status ? BookState::Available : BookState::Loaned, -1);
+}
+
+uint64_t Book::packStatus(BookState state, int userID) {
+    return (uint64_t(state) << 32) | static_cast<uint32_t>(userID);
+}
+
+BookState Book::getState() const {
+    return static_cast<BookState>(status.load() >> 32);
+}
+
+// The user the book is loaned to or held for; -1 when available or unknown.
+int Book::getHolder() const {
+    uint64_t current = status.load();
+    if (static_cast<BookState>(current >> 32) == BookState::Available) return -1;
+    return static_cast<int32_t>(static_cast<uint32_t>(current));
+}
+
+void Book::setState(BookState state, int userID) {
+    if (status.exchange(packStatus(state, userID)) != packStatus(state, userID)) dirty = true;
+}
+
+// Claims an available book, or one held for this user, without locking: of
+// several concurrent callers exactly one succeeds.
+bool Book::tryCheckout(int userID) {
+    uint64_t current = status.load();
+    const uint64_t loaned = packStatus(BookState::Loaned, userID);
+    for (;;) {
+        if (current != packStatus(BookState::Available, -1) &&
+            current != packStatus(BookState::Held, userID)) return false;
+        if (status.compare_exchange_weak(current, loaned)) {
+            dirty = true;
+            return true;
+        }
+    }
+}
+
+// Back from loan: held for holdFor, or available when nobody is waiting.
+void Book::checkIn(int holdFor) {
+    setState(holdFor != -1 ? BookState::Held : BookState::Available, holdFor);
+}
+
+bool Book::releaseHold(int userID) {
+    uint64_t expected = packStatus(BookState::Held, userID);
+    if (!status.compare_exchange_strong(expected, packStatus(BookState::Available, -1))) return false;
+    dirty = true;
+    return true;
+}
+bool Book::isDirty() const { return dirty; }
+void Book::clearDirty() { dirty = false; }
 
 bool Book::reserve(int userID) {
     if (isReservedBy(userID)) {
         return false;
     }
     
-    if (!available) {
-        reservationQueue.push(userID);
+    if (!isAvailable()) {
+        reservationPositions[userID] = reservationQueue.insert(reservationQueue.end(), userID);
+        dirty = true;
         return true;
     }
     return false;
 }
 
 bool Book::cancelReservation(int userID) {
-    if (reservationQueue.empty() || !isReservedBy(userID)) return false;
-    
-    queue<int> tempQueue;
-    bool found = false;
-    
-    while (!reservationQueue.empty()) {
-        int currentID = reservationQueue.front();
-        reservationQueue.pop();
-        
-        if (currentID != userID) {
-            tempQueue.push(currentID);
-        } else {
-            found = true;
-        }
-    }
+    auto it = reservationPositions.find(userID);
+    if (it == reservationPositions.end()) return false;
     
-    reservationQueue = tempQueue;
-    return found;
+    reservationQueue.erase(it->second);
+    reservationPositions.erase(it);
+    dirty = true;
+    return true;
 }
 
 bool Book::isReserved() const {
@@ -61,26 +232,152 @@ bool Book::isReserved() const {
 int Book::getNextReservation() {
     if (reservationQueue.empty()) return -1;
     int nextUser = reservationQueue.front();
-    reservationQueue.pop();
+    reservationQueue.pop_front();
+    reservationPositions.erase(nextUser);
+    dirty = true;
     return nextUser;
 }
 
 bool Book::isReservedBy(int userID) const {
-    queue<int> tempQueue = reservationQueue;
-    while (!tempQueue.empty()) {
-        if (tempQueue.front() == userID) return true;
-        tempQueue.pop();
+    return reservationPositions.count(userID) > 0;
+}
+
+const list<int>& Book::getReservationQueue() const {
+    return reservationQueue;
+}
+
+BookTable::Iterator::Iterator(const BookTable* table, size_t slot) : table(table), slot(slot) {
+    skipFree();
+}
+
+BookTable::Iterator& BookTable::Iterator::operator++() {
+    slot++;
+    skipFree();
+    return *this;
+}
+
+void BookTable::Iterator::skipFree() {
+    while (slot < table->occupied.size() && !table->occupied[slot]) slot++;
+}
+
+BookTable::~BookTable() {
+    clear();
+}
+
+Book* BookTable::slotAt(size_t slot) const {
+    return reinterpret_cast<Book*>(chunks[slot / CHUNK_SIZE]->bytes) + slot % CHUNK_SIZE;
+}
+
+// The direct index may run up to a few times ahead of the book count, so
+// catalogs numbered from 1 (or from any modest offset) stay dense, while a
+// stray huge ID can't blow it up.
+bool BookTable::fitsDense(int bookID) const {
+    return bookID >= 0 && static_cast<size_t>(bookID) < max(denseIndex.size(), 4 * count + 65536);
+}
+
+Book* BookTable::find(int bookID) const {
+    if (bookID >= 0 && static_cast<size_t>(bookID) < denseIndex.size()) {
+        uint32_t slot = denseIndex[bookID];
+        if (slot != 0) return slotAt(slot - 1);
     }
-    return false;
+    if (sparseIndex.empty()) return nullptr;
+    auto it = sparseIndex.find(bookID);
+    return it != sparseIndex.end() ? slotAt(it->second) : nullptr;
+}
+
+Book* BookTable::findFrom(int bookID) const {
+    Book* found = nullptr;
+    auto sparseIt = sparseIndex.lower_bound(bookID);
+    if (sparseIt != sparseIndex.end()) found = slotAt(sparseIt->second);
+
+    // Dense IDs are all non-negative, so only a non-negative sparse match
+    // can come after one.
+    if (!found || found->getBookID() >= 0) {
+        int limit = found ? found->getBookID() : static_cast<int>(denseIndex.size());
+        for (int id = max(bookID, 0); id < limit && static_cast<size_t>(id) < denseIndex.size(); id++) {
+            if (denseIndex[id] != 0) return slotAt(denseIndex[id] - 1);
+        }
+    }
+    return found;
+}
+
+Book* BookTable::insert(unique_ptr<Book> book) {
+    int bookID = book->getBookID();
+    if (find(bookID)) return nullptr;
+
+    size_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+        occupied[slot] = 1;
+    } else {
+        slot = occupied.size();
+        if (slot % CHUNK_SIZE == 0) chunks.push_back(unique_ptr<Chunk>(new Chunk));
+        occupied.push_back(1);
+    }
+    Book* stored = new (slotAt(slot)) Book(move(*book));
+    count++;
+
+    if (fitsDense(bookID)) {
+        if (static_cast<size_t>(bookID) >= denseIndex.size()) {
+            denseIndex.resize(max(static_cast<size_t>(bookID) + 1, 2 * denseIndex.size()), 0);
+        }
+        denseIndex[bookID] = static_cast<uint32_t>(slot + 1);
+    } else {
+        sparseIndex[bookID] = static_cast<uint32_t>(slot);
+    }
+    return stored;
+}
+
+bool BookTable::erase(int bookID) {
+    size_t slot;
+    if (bookID >= 0 && static_cast<size_t>(bookID) < denseIndex.size() && denseIndex[bookID] != 0) {
+        slot = denseIndex[bookID] - 1;
+        denseIndex[bookID] = 0;
+    } else {
+        auto it = sparseIndex.find(bookID);
+        if (it == sparseIndex.end()) return false;
+        slot = it->second;
+        sparseIndex.erase(it);
+    }
+    slotAt(slot)->~Book();
+    occupied[slot] = 0;
+    freeSlots.push_back(static_cast<uint32_t>(slot));
+    count--;
+    return true;
+}
+
+void BookTable::reserve(size_t capacity) {
+    occupied.reserve(capacity);
+    chunks.reserve((capacity + CHUNK_SIZE - 1) / CHUNK_SIZE);
 }
 
-Account::Account(int id) : userID(id), totalFine(0.0) {}
+void BookTable::clear() {
+    for (size_t slot = 0; slot < occupied.size(); slot++) {
+        if (occupied[slot]) slotAt(slot)->~Book();
+    }
+    chunks.clear();
+    occupied.clear();
+    freeSlots.clear();
+    denseIndex.clear();
+    sparseIndex.clear();
+    count = 0;
+}
 
+Account::Account(int id) : userID(id), totalFine(0.0), dirty(true) {}
+
+int Account::getUserID() const { return userID; }
 void Account::addBorrow(int bookID) {
     BorrowRecord record{bookID, 
                        chrono::system_clock::now(),
                        chrono::system_clock::now() + chrono::hours(24*30)};
     currentBorrows.push_back(record);
+    dirty = true;
+}
+
+void Account::addBorrow(const BorrowRecord& record) {
+    currentBorrows.push_back(record);
+    dirty = true;
 }
 
 void Account::removeBorrow(int bookID) {
@@ -90,435 +387,2386 @@ void Account::removeBorrow(int bookID) {
     if (it != currentBorrows.end()) {
         borrowHistory.push_back(*it);
         currentBorrows.erase(it);
+        dirty = true;
     }
 }
 
-const vector<BorrowRecord>& Account::getCurrentBorrows() const { return currentBorrows; }
-const vector<BorrowRecord>& Account::getBorrowHistory() const { return borrowHistory; }
+const BorrowList& Account::getCurrentBorrows() const { return currentBorrows; }
+const BorrowList& Account::getBorrowHistory() const { return borrowHistory; }
 double Account::getTotalFine() const { return totalFine; }
-void Account::addFine(double amount) { totalFine += amount; }
-void Account::payFine(double amount) { totalFine = max(0.0, totalFine - amount); }
-void Account::addToBorrowHistory(const BorrowRecord& record) { borrowHistory.push_back(record); }
+void Account::addFine(double amount) { totalFine += amount; dirty = true; }
+void Account::payFine(double amount) { totalFine = max(0.0, totalFine - amount); dirty = true; }
+void Account::setTotalFine(double amount) { totalFine = amount; dirty = true; }
+void Account::addToBorrowHistory(const BorrowRecord& record) { borrowHistory.push_back(record); dirty = true; }
+bool Account::isDirty() const { return dirty; }
+void Account::markDirty() { dirty = true; }
+void Account::clearDirty() { dirty = false; }
+
+optional<Role> parseRole(string_view name) {
+    for (size_t i = 0; i < ROLE_COUNT; i++) {
+        if (name == ROLE_POLICIES[i].name) return static_cast<Role>(i);
+    }
+    return nullopt;
+}
 
-Member::Member(int id, const string& name, const string& password)
-    : userID(id), name(name), password(password) {}
+Member::Member(int id, const string& name, const string& password, Role role)
+    : userID(id), role(role), dirty(true), name(name), password(password) {}
 
 int Member::getUserID() const { return userID; }
-string Member::getName() const { return name; }
-string Member::getRole() const { return role; }
-string Member::getDepartment() const { return department; }
-void Member::setDepartment(const string& dept) { department = dept; }
+const string& Member::getName() const { return name; }
+string_view Member::getRole() const { return getPolicy().name; }
+string_view Member::getDepartment() const { return department.view(); }
+void Member::setDepartment(const string& dept) { department = InternedString(dept); dirty = true; }
+bool Member::isDirty() const { return dirty; }
+void Member::clearDirty() { dirty = false; }
 
 Student::Student(int id, const string& name, const string& password)
-    : Member(id, name, password) {
-    role = "Student";
-}
+    : Member(id, name, password, Role::Student) {}
 
 Professor::Professor(int id, const string& name, const string& password)
-    : Member(id, name, password) {
-    role = "Professor";
-}
+    : Member(id, name, password, Role::Professor) {}
 
 Librarian::Librarian(int id, const string& name, const string& password)
-    : Member(id, name, password) {
-    role = "Librarian";
-}
+    : Member(id, name, password, Role::Librarian) {}
 
-Library::~Library() = default;
+size_t ScoreMap::slotFor(int id) const {
+    size_t mask = slots.size() - 1;
+    size_t slot = (static_cast<uint32_t>(id) * 2654435761u) & mask;
+    while (slots[slot] != 0 && entries[slots[slot] - 1].first != id) slot = (slot + 1) & mask;
+    return slot;
+}
 
-template<typename Func>
-void Library::readDataFile(const string& filename, Func&& callback) {
-    ifstream file(filename);
-    if (file.is_open()) {
-        string line;
-        while (getline(file, line)) {
-            auto parts = split(line, '|');
-            callback(parts);
-        }
-        file.close();
+void ScoreMap::grow() {
+    slots.assign(max<size_t>(16, slots.size() * 2), 0);
+    for (size_t i = 0; i < entries.size(); i++) {
+        slots[slotFor(entries[i].first)] = static_cast<uint32_t>(i + 1);
     }
 }
 
-bool Library::addBook(unique_ptr<Book> book) {
-    int bookID = book->getBookID();
-    if (books.find(bookID) != books.end()) return false;
-    books[bookID] = move(book);
-    return true;
+int& ScoreMap::operator[](int id) {
+    if (2 * (entries.size() + 1) > slots.size()) grow();
+    size_t slot = slotFor(id);
+    if (slots[slot] == 0) {
+        entries.push_back({id, 0});
+        slots[slot] = static_cast<uint32_t>(entries.size());
+    }
+    return entries[slots[slot] - 1].second;
 }
 
-bool Library::removeBook(int bookID) {
-    return books.erase(bookID) > 0;
+const int* ScoreMap::find(int id) const {
+    if (slots.empty()) return nullptr;
+    size_t slot = slotFor(id);
+    return slots[slot] != 0 ? &entries[slots[slot] - 1].second : nullptr;
 }
 
-bool Library::addUser(unique_ptr<Member> user) {
-    int userID = user->getUserID();
-    if (users.find(userID) != users.end()) return false;
-    accounts[userID] = make_unique<Account>(userID);
-    users[userID] = move(user);
-    return true;
+// Calls visit with each lowercased alphanumeric word of text in turn. The
+// word buffer is reused, so visit must copy what it keeps.
+template<typename Visit>
+static void forEachWord(string_view text, Visit&& visit) {
+    string word;
+    for (char c : text) {
+        if (isalnum(static_cast<unsigned char>(c))) {
+            word += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        } else if (!word.empty()) {
+            visit(word);
+            word.clear();
+        }
+    }
+    if (!word.empty()) visit(word);
 }
 
-bool Library::removeUser(int userID) {
-    accounts.erase(userID);
-    return users.erase(userID) > 0;
+vector<string> TokenIndex::tokenize(string_view text) {
+    vector<string> words;
+    forEachWord(text, [&words](const string& word) { words.push_back(word); });
+    return words;
 }
 
-bool Library::borrowBook(int userID, int bookID) {
-    auto userIt = users.find(userID);
-    auto bookIt = books.find(bookID);
-    
-    if (userIt == users.end() || bookIt == books.end()) return false;
-    
-    if (!userIt->second->canBorrow()) return false;
-    
-    if (!bookIt->second->isAvailable()) return false;
-    
-    auto account = accounts[userID].get();
-    
-    if (account->getCurrentBorrows().size() >= userIt->second->getMaxBooks()) return false;
-    
-    for (const auto& borrow : account->getCurrentBorrows()) {
-        if (borrow.bookID == bookID) return false;
+void TokenIndex::add(int id, string_view text) {
+    vector<string> words = tokenize(text);
+    sort(words.begin(), words.end());
+    words.erase(unique(words.begin(), words.end()), words.end());
+    for (const string& word : words) {
+        auto inserted = postings.emplace(word, vector<int>());
+        if (inserted.second) addTrigrams(&inserted.first->first);
+        vector<int>& ids = inserted.first->second;
+        ids.insert(lower_bound(ids.begin(), ids.end(), id), id);
     }
-    
-    if (account->getTotalFine() > 0) return false;
-    
-    bookIt->second->setAvailable(false);
-    account->addBorrow(bookID);
-    saveState(); 
-    return true;
 }
 
-bool Library::returnBook(int userID, int bookID) {
-    auto userIt = users.find(userID);
-    auto bookIt = books.find(bookID);
-    
-    if (userIt == users.end() || bookIt == books.end()) return false;
-    
-    auto account = accounts[userID].get();
-    if (!account) return false;
-    
-    bool hasBorrowed = false;
-    for (const auto& borrow : account->getCurrentBorrows()) {
-        if (borrow.bookID == bookID) {
-            hasBorrowed = true;
-            break;
+void TokenIndex::remove(int id, string_view text) {
+    for (const string& word : tokenize(text)) {
+        auto it = postings.find(word);
+        if (it == postings.end()) continue;
+        vector<int>& ids = it->second;
+        auto pos = lower_bound(ids.begin(), ids.end(), id);
+        if (pos != ids.end() && *pos == id) ids.erase(pos);
+        if (ids.empty()) {
+            removeTrigrams(&it->first);
+            postings.erase(it);
         }
     }
-    if (!hasBorrowed) return false;
-    
-    auto now = chrono::system_clock::now();
-    for (const auto& borrow : account->getCurrentBorrows()) {
-        if (borrow.bookID == bookID && now > borrow.dueDate) {
-            auto overdueHours = chrono::duration_cast<chrono::hours>(now - borrow.dueDate).count();
-            double fine = overdueHours * userIt->second->getFineRate();
-            account->addFine(fine);
-            break;
-        }
+}
+
+void TokenIndex::clear() {
+    postings.clear();
+    trigrams.clear();
+}
+
+// Postings are gathered in a hash table first and then moved into the ordered
+// map in key order, so a load places each distinct word once instead of
+// searching the tree for every word of every book.
+void TokenIndex::build(const vector<pair<int, string_view>>& texts) {
+    clear();
+    unordered_map<string, vector<int>> gathered;
+    for (const auto& text : texts) {
+        forEachWord(text.second, [&gathered, &text](const string& word) {
+            vector<int>& ids = gathered.try_emplace(word).first->second;
+            if (ids.empty() || ids.back() != text.first) ids.push_back(text.first);
+        });
     }
-    
-    account->removeBorrow(bookID);
-    
-    if (bookIt->second->isReserved()) {
-        int nextUserID = bookIt->second->getNextReservation();
-        if (nextUserID != -1) {
-            borrowBook(nextUserID, bookID);
-        } else {
-            bookIt->second->setAvailable(true);
-            saveState(); 
+
+    vector<unordered_map<string, vector<int>>::iterator> words;
+    words.reserve(gathered.size());
+    for (auto it = gathered.begin(); it != gathered.end(); ++it) words.push_back(it);
+    sort(words.begin(), words.end(), [](const auto& a, const auto& b) { return a->first < b->first; });
+    for (auto& word : words) {
+        auto node = gathered.extract(word);
+        vector<int>& ids = node.mapped();
+        if (!is_sorted(ids.begin(), ids.end())) {
+            sort(ids.begin(), ids.end());
+            ids.erase(unique(ids.begin(), ids.end()), ids.end());
         }
-    } else {
-        bookIt->second->setAvailable(true);
-        saveState(); 
+        auto entry = postings.emplace_hint(postings.end(), move(node.key()), move(ids));
+        addTrigrams(&entry->first);
     }
-    
-    return true;
 }
 
-bool Library::authenticateUser(int userID, const string& password) const {
-    auto it = users.find(userID);
-    return (it != users.end() && it->second->verifyPassword(password));
+// Trigrams of the word padded with two '$' on either side, packed into an
+// int; a word of length n has n + 2 of them.
+vector<uint32_t> TokenIndex::trigramsOf(const string& word) {
+    string padded = "$$" + word + "$$";
+    vector<uint32_t> grams;
+    for (size_t i = 0; i + 3 <= padded.size(); i++) {
+        grams.push_back((uint32_t(uint8_t(padded[i])) << 16) |
+                        (uint32_t(uint8_t(padded[i + 1])) << 8) | uint8_t(padded[i + 2]));
+    }
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    return grams;
 }
 
-bool Library::payFine(int userID, double amount) {
-    auto accountIt = accounts.find(userID);
-    if (accountIt == accounts.end()) return false;
-    accountIt->second->payFine(amount);
-    return true;
+void TokenIndex::addTrigrams(const string* word) {
+    for (uint32_t gram : trigramsOf(*word)) {
+        trigrams[gram].push_back(word);
+    }
 }
 
-const Book* Library::getBook(int bookID) const {
-    auto it = books.find(bookID);
-    return it != books.end() ? it->second.get() : nullptr;
+void TokenIndex::removeTrigrams(const string* word) {
+    for (uint32_t gram : trigramsOf(*word)) {
+        auto it = trigrams.find(gram);
+        if (it == trigrams.end()) continue;
+        auto& words = it->second;
+        words.erase(std::remove(words.begin(), words.end(), word), words.end());
+        if (words.empty()) trigrams.erase(it);
+    }
 }
 
-const Member* Library::getMember(int userID) const {
-    auto it = users.find(userID);
-    return it != users.end() ? it->second.get() : nullptr;
-}
+// Levenshtein distance between a and b. Patterns of up to 64 characters use
+// Myers' bit-parallel algorithm (one pass over b, a few word operations per
+// character); longer ones fall back to the textbook row-by-row table.
+static int editDistance(const string& a, const string& b) {
+    size_t m = a.size();
+    if (m == 0) return b.size();
 
-Account* Library::getAccount(int userID) const {
-    auto it = accounts.find(userID);
-    return it != accounts.end() ? it->second.get() : nullptr;
-}
+    if (m <= 64) {
+        uint64_t peq[256] = {0};
+        for (size_t i = 0; i < m; i++) {
+            peq[uint8_t(a[i])] |= uint64_t(1) << i;
+        }
+        uint64_t pv = ~uint64_t(0);
+        uint64_t mv = 0;
+        uint64_t last = uint64_t(1) << (m - 1);
+        int score = m;
+        for (char c : b) {
+            uint64_t eq = peq[uint8_t(c)];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & last) score++;
+            else if (mh & last) score--;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return score;
+    }
 
-vector<const Book*> Library::searchBooks(const string& query) const {
-    vector<const Book*> results;
-    string lowerQuery = query;
-    transform(lowerQuery.begin(), lowerQuery.end(), lowerQuery.begin(), ::tolower);
-    
-    for (const auto& pair : books) {
-        string title = pair.second->getTitle();
-        transform(title.begin(), title.end(), title.begin(), ::tolower);
-        if (title.find(lowerQuery) != string::npos) {
-            results.push_back(pair.second.get());
+    vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) row[j] = j;
+    for (size_t i = 1; i <= m; i++) {
+        int diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= b.size(); j++) {
+            int above = row[j];
+            row[j] = min({row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1])});
+            diagonal = above;
         }
     }
-    return results;
+    return row[b.size()];
 }
 
-bool Library::reserveBook(int userID, int bookID) {
-    auto bookIt = books.find(bookID);
-    if (bookIt == books.end()) return false;
-    bool success = bookIt->second->reserve(userID);
-    if (success) {
-        saveState(); 
+// Candidates share enough trigrams with the query word to be within
+// maxDistance edits (each edit destroys at most three); they are then
+// verified with editDistance(). When the word is too short for the trigram
+// bound to prune anything, every index word of a close enough length is
+// checked instead. Each match raises the book's score to
+// scale * (maxDistance + 1 - distance).
+void TokenIndex::matchFuzzy(const string& word, int maxDistance, int scale, ScoreMap& scores) const {
+    auto consider = [&](const string& candidate) {
+        size_t lengthGap = max(candidate.size(), word.size()) - min(candidate.size(), word.size());
+        if (lengthGap > size_t(maxDistance)) return;
+        int distance = editDistance(word, candidate);
+        if (distance > maxDistance) return;
+        int score = scale * (maxDistance + 1 - distance);
+        for (int id : postings.at(candidate)) {
+            int& best = scores[id];
+            best = max(best, score);
+        }
+    };
+
+    vector<uint32_t> grams = trigramsOf(word);
+    int minShared = int(grams.size()) - 3 * maxDistance;
+    if (minShared <= 0) {
+        for (const auto& entry : postings) consider(entry.first);
+        return;
+    }
+
+    unordered_map<const string*, int> shared;
+    for (uint32_t gram : grams) {
+        auto it = trigrams.find(gram);
+        if (it == trigrams.end()) continue;
+        for (const string* candidate : it->second) shared[candidate]++;
+    }
+    for (const auto& entry : shared) {
+        if (entry.second >= minShared) consider(*entry.first);
     }
-    return success;
 }
 
-bool Library::cancelReservation(int userID, int bookID) {
-    auto bookIt = books.find(bookID);
-    if (bookIt == books.end()) return false;
-    bool success = bookIt->second->cancelReservation(userID);
-    if (success) {
-        saveState(); 
+void TokenIndex::match(const string& word, int exactScore, int prefixScore, ScoreMap& scores) const {
+    for (auto it = postings.lower_bound(word);
+         it != postings.end() && it->first.compare(0, word.size(), word) == 0; ++it) {
+        int score = (it->first.size() == word.size()) ? exactScore : prefixScore;
+        for (int id : it->second) {
+            int& best = scores[id];
+            best = max(best, score);
+        }
     }
-    return success;
 }
 
-vector<const Book*> Library::getReservedBooks(int userID) const {
-    vector<const Book*> reservedBooks;
-    for (const auto& pair : books) {
-        if (pair.second->isReservedBy(userID)) {
-            reservedBooks.push_back(pair.second.get());
+string PrefixIndex::normalize(string_view text) {
+    string key;
+    forEachWord(text, [&key](const string& word) {
+        if (!key.empty()) key += ' ';
+        key += word;
+    });
+    return key;
+}
+
+// Shared by more entries first; ties in key order.
+bool PrefixIndex::ranksBefore(EntryRef a, EntryRef b) {
+    if (a->second.count != b->second.count) return a->second.count > b->second.count;
+    return a->first < b->first;
+}
+
+// changed was just added or its count went up, so it can only move up in the
+// rankings of its key's prefixes. Those rankings are full: their prefixes
+// matched more keys than any ranking holds.
+void PrefixIndex::raiseInRankings(EntryRef changed) {
+    lock_guard<mutex> lock(rankingMutex);
+    if (rankings.empty()) return;
+    string_view key = changed->first;
+    for (size_t length = 1; length <= key.size(); length++) {
+        auto ranking = rankings.find(key.substr(0, length));
+        if (ranking == rankings.end()) continue;
+        vector<EntryRef>& top = ranking->second;
+        auto position = find(top.begin(), top.end(), changed);
+        if (position == top.end()) {
+            if (!ranksBefore(changed, top.back())) continue;
+            top.back() = changed;
+            position = top.end() - 1;
+        }
+        for (; position != top.begin() && ranksBefore(*position, *(position - 1)); --position) {
+            iter_swap(position, position - 1);
         }
     }
-    return reservedBooks;
 }
 
-void Library::saveState() const {
-    system("mkdir data 2>nul");
-    system("mkdir data\\accounts 2>nul");
+// changed is about to lose a count or be erased. A ranking holding it could
+// now miss a key that overtakes it, so it is rebuilt on the next lookup.
+void PrefixIndex::dropRankingsWith(EntryRef changed) {
+    lock_guard<mutex> lock(rankingMutex);
+    if (rankings.empty()) return;
+    string_view key = changed->first;
+    for (size_t length = 1; length <= key.size(); length++) {
+        auto ranking = rankings.find(key.substr(0, length));
+        if (ranking == rankings.end()) continue;
+        const vector<EntryRef>& top = ranking->second;
+        if (find(top.begin(), top.end(), changed) != top.end()) rankings.erase(ranking);
+    }
+}
 
-    ofstream bookFile("data/books.txt");
-    if (!bookFile.is_open()) {
-        cerr << "Error: Could not open books.txt for writing" << endl;
-        return;
+void PrefixIndex::add(string_view text) {
+    string key = normalize(text);
+    if (key.empty()) return;
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        it->second.count++;
+    } else {
+        it = entries.emplace(move(key), Entry{string(text), 1}).first;
     }
-    
-    for (const auto& pair : books) {
-        const auto& book = pair.second;
-        bookFile << pair.first << "|" << book->getTitle() << "|" << book->getAuthor() 
-                 << "|" << book->getPublisher() << "|" << book->getYear() 
-                 << "|" << book->getISBN() << "|" << book->isAvailable() << "\n";
+    raiseInRankings(it);
+}
+
+void PrefixIndex::remove(string_view text) {
+    auto it = entries.find(normalize(text));
+    if (it == entries.end()) return;
+    dropRankingsWith(it);
+    if (--it->second.count == 0) entries.erase(it);
+}
+
+void PrefixIndex::clear() {
+    entries.clear();
+    lock_guard<mutex> lock(rankingMutex);
+    rankings.clear();
+}
+
+// Texts are counted per key in a hash table first, since authors repeat
+// across many books; only the distinct keys are then sorted and placed in the
+// map in order. Equal keys keep the spelling of the first text, as add() would.
+void PrefixIndex::build(const vector<string_view>& texts) {
+    clear();
+    unordered_map<string, Entry> gathered;
+    gathered.reserve(texts.size());
+    for (string_view text : texts) {
+        string key = normalize(text);
+        if (key.empty()) continue;
+        auto inserted = gathered.try_emplace(move(key), Entry{string(), 0});
+        if (inserted.second) inserted.first->second.display = string(text);
+        inserted.first->second.count++;
     }
-    bookFile.close();
 
-    ofstream studentFile("data/users/students.txt");
-    ofstream professorFile("data/users/professors.txt");
-    ofstream librarianFile("data/users/librarians.txt");
+    vector<unordered_map<string, Entry>::iterator> keys;
+    keys.reserve(gathered.size());
+    for (auto it = gathered.begin(); it != gathered.end(); ++it) keys.push_back(it);
+    sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a->first < b->first; });
+    for (auto& key : keys) {
+        auto node = gathered.extract(key);
+        entries.emplace_hint(entries.end(), move(node.key()), move(node.mapped()));
+    }
+}
 
-    if (!studentFile.is_open() || !professorFile.is_open() || !librarianFile.is_open()) {
-        cerr << "Error: Could not open user files for writing" << endl;
-        return;
+// The best limit keys starting with key, from a heap over all of them.
+vector<PrefixIndex::EntryRef> PrefixIndex::scan(const string& key, size_t limit) const {
+    vector<EntryRef> top;
+    for (auto it = entries.lower_bound(key); it != entries.end() && it->first.compare(0, key.size(), key) == 0; ++it) {
+        if (top.size() < limit) {
+            top.push_back(it);
+            push_heap(top.begin(), top.end(), ranksBefore);
+        } else if (ranksBefore(it, top.front())) {
+            pop_heap(top.begin(), top.end(), ranksBefore);
+            top.back() = it;
+            push_heap(top.begin(), top.end(), ranksBefore);
+        }
     }
+    sort_heap(top.begin(), top.end(), ranksBefore);
+    return top;
+}
 
-    for (const auto& pair : users) {
-        const auto& user = pair.second;
-        string userLine = to_string(pair.first) + "|" + user->getName() + "|" + 
-                         user->getPassword() + "|" + user->getDepartment() + "\n";
-        
-        if (user->getRole() == "Student") {
-            studentFile << userLine;
-        } else if (user->getRole() == "Professor") {
-            professorFile << userLine;
-        } else if (user->getRole() == "Librarian") {
-            librarianFile << userLine;
+// Like scan() for limit up to RANKED_KEYS. A prefix with more keys than that
+// is ranked from its own key, if present, and the rankings of the prefixes one
+// character longer, and the result is kept; so each key is scanned once, under
+// its longest prefix with few keys, however many prefixes are typed above it.
+vector<PrefixIndex::EntryRef> PrefixIndex::rank(const string& key, size_t limit) const {
+    {
+        lock_guard<mutex> lock(rankingMutex);
+        auto ranking = rankings.find(key);
+        if (ranking != rankings.end() && ranking->second.size() >= limit) {
+            return vector<EntryRef>(ranking->second.begin(), ranking->second.begin() + limit);
         }
     }
 
-    studentFile.close();
-    professorFile.close();
-    librarianFile.close();
+    auto first = entries.lower_bound(key);
+    auto it = first;
+    size_t matched = 0;
+    for (; it != entries.end() && matched <= RANKED_KEYS && it->first.compare(0, key.size(), key) == 0; ++it) {
+        matched++;
+    }
+    if (matched <= RANKED_KEYS) return scan(key, limit);
 
-    for (const auto& pair : accounts) {
-        const auto& account = pair.second;
-        string accountPath = "data/accounts/" + to_string(pair.first) + ".txt";
-        ofstream accountFile(accountPath);
-        
-        if (!accountFile.is_open()) {
-            cerr << "Error: Could not open account file for writing: " << accountPath << endl;
-            continue;
-        }
-        
-        for (const auto& record : account->getCurrentBorrows()) {
-            accountFile << "BORROW|" << record.bookID << "|"
-                       << chrono::system_clock::to_time_t(record.borrowDate) << "|"
-                       << chrono::system_clock::to_time_t(record.dueDate) << "\n";
-        }
-        
-        for (const auto& record : account->getBorrowHistory()) {
-            accountFile << "HISTORY|" << record.bookID << "|"
-                       << chrono::system_clock::to_time_t(record.borrowDate) << "|"
-                       << chrono::system_clock::to_time_t(record.dueDate) << "\n";
-        }
-        
-        accountFile << "FINE|" << account->getTotalFine() << "\n";
-        
-        accountFile.close();
+    vector<EntryRef> candidates;
+    it = first;
+    if (it->first.size() == key.size()) candidates.push_back(it++);
+    string child = key + ' ';
+    while (it != entries.end() && it->first.compare(0, key.size(), key) == 0) {
+        child.back() = it->first[key.size()];
+        vector<EntryRef> best = rank(child, limit);
+        candidates.insert(candidates.end(), best.begin(), best.end());
+        if (static_cast<unsigned char>(child.back()) == numeric_limits<unsigned char>::max()) break;
+        child.back()++;
+        it = entries.lower_bound(child);
     }
+    size_t kept = min(limit, candidates.size());
+    partial_sort(candidates.begin(), candidates.begin() + kept, candidates.end(), ranksBefore);
+    candidates.resize(kept);
+
+    lock_guard<mutex> lock(rankingMutex);
+    rankings.insert_or_assign(key, candidates);
+    return candidates;
 }
 
-void Library::loadState() {
-    cout << "Loading state..." << endl;
-    
-    books.clear();
-    users.clear();
-    accounts.clear();
+// A trailing space in what was typed is kept, so "the " only completes to
+// keys with another word after "the".
+vector<string> PrefixIndex::complete(const string& prefix, size_t limit) const {
+    vector<string> results;
+    string key = normalize(prefix);
+    if (key.empty() || limit == 0) return results;
+    if (!prefix.empty() && !isalnum(static_cast<unsigned char>(prefix.back()))) key += ' ';
 
-    cout << "Loading books..." << endl;
-    readDataFile("data/books.txt", [this](const auto& parts) {
-        if (parts.size() == 7) {
-            int id = stoi(parts[0]);
-            int year = stoi(parts[4]);
-            bool available = parts[6] == "1";
-            auto book = make_unique<Book>(id, parts[1], parts[2], parts[3], year, parts[5]);
-            book->setAvailable(available);
-            addBook(move(book));
-            cout << "Loaded book: " << parts[1] << " (ID: " << id << ")" << endl;
-        }
-    });
-    cout << "Total books loaded: " << books.size() << endl;
-
-    cout << "Loading students..." << endl;
-    readDataFile("data/users/students.txt", [this](const auto& parts) {
-        if (parts.size() == 4) {
-            int id = stoi(parts[0]);
-            auto student = make_unique<Student>(id, parts[1], parts[2]);
-            student->setDepartment(parts[3]);
-            addUser(move(student));
-            loadAccountInfo(id);
-            cout << "Loaded student: " << parts[1] << " (ID: " << id << ")" << endl;
-        }
-    });
+    vector<EntryRef> top = limit <= RANKED_KEYS ? rank(key, limit) : scan(key, limit);
+    results.reserve(top.size());
+    for (EntryRef entry : top) results.push_back(entry->second.display);
+    return results;
+}
 
-    cout << "Loading professors..." << endl;
-    readDataFile("data/users/professors.txt", [this](const auto& parts) {
-        if (parts.size() == 4) {
-            int id = stoi(parts[0]);
-            auto professor = make_unique<Professor>(id, parts[1], parts[2]);
-            professor->setDepartment(parts[3]);
-            addUser(move(professor));
-            loadAccountInfo(id);
-            cout << "Loaded professor: " << parts[1] << " (ID: " << id << ")" << endl;
-        }
-    });
+// Moves the journal's records to rotatedPath and leaves the journal empty. If
+// rotatedPath is still there from a checkpoint that never finished, the
+// records are appended to it so that the older ones stay first.
+static void rotateJournalFile(const string& path, const string& rotatedPath) {
+    error_code error;
+    if (!filesystem::exists(rotatedPath, error)) {
+        filesystem::rename(path, rotatedPath, error);
+    } else {
+        ifstream journalFile(path, ios::binary);
+        ofstream rotatedFile(rotatedPath, ios::binary | ios::app);
+        if (journalFile.is_open() && journalFile.peek() != EOF) rotatedFile << journalFile.rdbuf();
+    }
+    ofstream journalFile(path, ios::trunc);
+}
 
-    cout << "Loading librarians..." << endl;
-    readDataFile("data/users/librarians.txt", [this](const auto& parts) {
-        if (parts.size() == 4) {
-            int id = stoi(parts[0]);
-            auto librarian = make_unique<Librarian>(id, parts[1], parts[2]);
-            librarian->setDepartment(parts[3]);
-            addUser(move(librarian));
-            loadAccountInfo(id);
-            cout << "Loaded librarian: " << parts[1] << " (ID: " << id << ")" << endl;
-        }
-    });
-    cout << "State loading complete" << endl;
+JournalWriter::JournalWriter(const string& path, chrono::milliseconds commitInterval, size_t batchSize)
+    : path(path), commitInterval(commitInterval), batchSize(batchSize) {
+    flusher = thread(&JournalWriter::run, this);
 }
 
-void Library::loadAccountInfo(int userID) {
-    string accountPath = "data/accounts/" + to_string(userID) + ".txt";
-    ifstream file(accountPath);
+JournalWriter::~JournalWriter() {
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    workReady.notify_one();
+    flusher.join();
+}
+
+void JournalWriter::append(string record) {
+    {
+        lock_guard<mutex> lock(mtx);
+        pending.push_back(move(record));
+        enqueued++;
+    }
+    workReady.notify_one();
+}
+
+// Blocks until every record appended before the call has been written out.
+void JournalWriter::sync() {
+    unique_lock<mutex> lock(mtx);
+    size_t target = enqueued;
+    syncWaiters++;
+    workReady.notify_one();
+    batchCommitted.wait(lock, [this, target] { return committed >= target; });
+    syncWaiters--;
+}
+
+// Once the flusher is idle the file is moved away underneath it; the flusher
+// reopens the path before writing its next batch.
+void JournalWriter::rotate(const string& rotatedPath) {
+    unique_lock<mutex> lock(mtx);
+    syncWaiters++;
+    workReady.notify_one();
+    batchCommitted.wait(lock, [this] { return committed >= enqueued; });
+    syncWaiters--;
+    rotateJournalFile(path, rotatedPath);
+    reopen = true;
+}
+
+void JournalWriter::setCommitPolicy(chrono::milliseconds interval, size_t batch) {
+    lock_guard<mutex> lock(mtx);
+    commitInterval = interval;
+    batchSize = batch;
+}
+
+void JournalWriter::run() {
+    ofstream file(path, ios::app);
     if (!file.is_open()) {
-        accounts[userID] = make_unique<Account>(userID);
+        cerr << "Error: Could not open " << path << " for writing" << endl;
+    }
+
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+        workReady.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty()) break;
+
+        // Give the batch a chance to fill up before paying for the write.
+        workReady.wait_for(lock, commitInterval, [this] {
+            return stopping || syncWaiters > 0 || pending.size() >= batchSize;
+        });
+
+        deque<string> batch;
+        batch.swap(pending);
+        size_t batchEnd = enqueued;
+        bool reopenFile = reopen;
+        reopen = false;
+        lock.unlock();
+
+        if (reopenFile) {
+            file.close();
+            file.clear();
+            file.open(path, ios::app);
+        }
+        for (const string& record : batch) {
+            file << record << "\n";
+        }
+        file.flush();
+
+        lock.lock();
+        committed = batchEnd;
+        batchCommitted.notify_all();
+    }
+}
+
+static unique_ptr<Member> createMember(Role role, int id, const string& name, const string& password) {
+    return make_unique<Member>(id, name, password, role);
+}
+
+void WriterPriorityMutex::lock() {
+    waitingWriters.fetch_add(1);
+    rw.lock();
+    // The count drops under gateMutex, so a reader that saw it non-zero is
+    // already waiting when the notification goes out.
+    lock_guard<mutex> guard(gateMutex);
+    if (waitingWriters.fetch_sub(1) == 1) gate.notify_all();
+}
+
+void WriterPriorityMutex::lock_shared() {
+    if (waitingWriters.load() != 0) {
+        unique_lock<mutex> guard(gateMutex);
+        gate.wait(guard, [this] { return waitingWriters.load() == 0; });
+    }
+    rw.lock_shared();
+}
+
+Library::~Library() = default;
+
+// Holds up to three stripe locks. They are always taken in address order, so
+// two callers needing overlapping stripes cannot deadlock; a stripe shared by
+// two of the keys is locked once.
+class StripeLock {
+private:
+    mutex* held[3];
+    size_t count = 0;
+
+public:
+    StripeLock(mutex* first, mutex* second = nullptr, mutex* third = nullptr) {
+        for (mutex* stripe : {first, second, third}) {
+            if (!stripe || find(held, held + count, stripe) != held + count) continue;
+            size_t i = count++;
+            for (; i > 0 && less<mutex*>()(stripe, held[i - 1]); i--) held[i] = held[i - 1];
+            held[i] = stripe;
+        }
+        for (size_t i = 0; i < count; i++) held[i]->lock();
+    }
+    ~StripeLock() {
+        for (size_t i = count; i-- > 0;) held[i]->unlock();
+    }
+    StripeLock(const StripeLock&) = delete;
+    StripeLock& operator=(const StripeLock&) = delete;
+};
+
+RecordFields::RecordFields(string_view line, char delimiter) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    for (;;) {
+        size_t end = line.find(delimiter);
+        if (count < MAX_FIELDS) fields[count] = line.substr(0, end);
+        count++;
+        if (end == string_view::npos) break;
+        line.remove_prefix(end + 1);
+    }
+}
+
+template<typename Func>
+void Library::readDataFile(const string& filename, Func&& callback) {
+    ifstream file(filename);
+    if (file.is_open()) {
+        string line;
+        while (getline(file, line)) {
+            RecordFields parts(line, '|');
+            callback(parts);
+        }
+        file.close();
+    }
+}
+
+static bool readWholeFile(const string& filename, string& content) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) return false;
+    content.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    return true;
+}
+
+bool Library::addBook(unique_ptr<Book> book) {
+    unique_lock<WriterPriorityMutex> lock(catalogMutex);
+    return addBookLocked(move(book));
+}
+
+// Bulk path for imports: one exclusive lock for the whole batch, and the ISBN
+// index and book table grown at most once per batch. Growth is geometric so
+// that a stream of batches doesn't rehash on every call. Books whose ID or
+// ISBN is already in the catalog (or earlier in the batch) are skipped.
+// Returns how many were added.
+size_t Library::addBooks(vector<unique_ptr<Book>>& batch) {
+    unique_lock<WriterPriorityMutex> lock(catalogMutex);
+    size_t needed = books.size() + batch.size();
+    if (needed > isbnIndex.bucket_count() * isbnIndex.max_load_factor()) {
+        size_t capacity = max(needed, 2 * books.size());
+        isbnIndex.reserve(capacity);
+        books.reserve(capacity);
+    }
+
+    size_t added = 0;
+    for (auto& book : batch) {
+        string isbn = normalizeISBN(book->getISBN());
+        if (!isbn.empty() && isbnIndex.count(isbn) > 0) continue;
+        if (addBookLocked(move(book))) added++;
+    }
+    return added;
+}
+
+// Joins record fields with '|', the separator of every data file.
+static string joinFields(initializer_list<string_view> fields) {
+    string record;
+    bool first = true;
+    for (string_view field : fields) {
+        if (!first) record += '|';
+        record += field;
+        first = false;
+    }
+    return record;
+}
+
+bool Library::addBookLocked(unique_ptr<Book> book) {
+    int bookID = book->getBookID();
+    if (books.find(bookID)) return false;
+    appendJournal(joinFields({"ADDBOOK", to_string(bookID), book->getTitle(), book->getAuthor(),
+                              book->getPublisher(), to_string(book->getYear()), book->getISBN()}));
+    titleIndex.add(bookID, book->getTitle());
+    authorIndex.add(bookID, book->getAuthor());
+    publisherIndex.add(bookID, book->getPublisher());
+    completions.add(book->getTitle());
+    completions.add(book->getAuthor());
+    indexISBN(bookID, book->getISBN());
+    yearIndex.insert({book->getYear(), bookID});
+    books.insert(move(book));
+    booksChanged = true;
+    return true;
+}
+
+// Rebuilds every search index from the books in the table. Loading inserts
+// the books directly and calls this once, which is several times faster than
+// indexing them one addBook() at a time. Expects the exclusive catalog lock,
+// or a library that isn't shared yet.
+void Library::indexBooks() {
+    vector<pair<int, string_view>> titles, authors, publishers;
+    vector<string_view> completionTexts;
+    vector<pair<int, int>> years;
+    titles.reserve(books.size());
+    authors.reserve(books.size());
+    publishers.reserve(books.size());
+    completionTexts.reserve(2 * books.size());
+    years.reserve(books.size());
+
+    isbnIndex.clear();
+    isbnIndex.reserve(books.size());
+    for (const Book& book : books) {
+        int bookID = book.getBookID();
+        titles.push_back({bookID, book.getTitle()});
+        authors.push_back({bookID, book.getAuthor()});
+        publishers.push_back({bookID, book.getPublisher()});
+        completionTexts.push_back(book.getTitle());
+        completionTexts.push_back(book.getAuthor());
+        years.push_back({book.getYear(), bookID});
+        string isbn = normalizeISBN(book.getISBN());
+        if (!isbn.empty()) isbnIndex[move(isbn)].push_back(bookID);
+    }
+    for (auto& entry : isbnIndex) sort(entry.second.begin(), entry.second.end());
+
+    titleIndex.build(titles);
+    authorIndex.build(authors);
+    publisherIndex.build(publishers);
+    completions.build(completionTexts);
+    sort(years.begin(), years.end());
+    yearIndex.clear();
+    yearIndex.insert(years.begin(), years.end());
+}
+
+// Several books may share an ISBN (copies added one by one, or ISBNs that
+// only differ in hyphenation), so each ISBN keeps all of its book IDs in
+// ascending order. Books without an ISBN are not indexed.
+void Library::indexISBN(int bookID, string_view isbn) {
+    string normalized = normalizeISBN(isbn);
+    if (normalized.empty()) return;
+    vector<int>& ids = isbnIndex[move(normalized)];
+    ids.insert(lower_bound(ids.begin(), ids.end(), bookID), bookID);
+}
+
+void Library::unindexISBN(int bookID, string_view isbn) {
+    auto it = isbnIndex.find(normalizeISBN(isbn));
+    if (it == isbnIndex.end()) return;
+    vector<int>& ids = it->second;
+    auto found = lower_bound(ids.begin(), ids.end(), bookID);
+    if (found != ids.end() && *found == bookID) ids.erase(found);
+    if (ids.empty()) isbnIndex.erase(it);
+}
+
+bool Library::removeBook(int bookID) {
+    unique_lock<WriterPriorityMutex> lock(catalogMutex);
+    const Book* found = books.find(bookID);
+    if (!found) return false;
+    const Book& book = *found;
+    for (int userID : book.getReservationQueue()) {
+        unindexReservation(userID, bookID);
+    }
+    titleIndex.remove(bookID, book.getTitle());
+    authorIndex.remove(bookID, book.getAuthor());
+    publisherIndex.remove(bookID, book.getPublisher());
+    completions.remove(book.getTitle());
+    completions.remove(book.getAuthor());
+    unindexISBN(bookID, book.getISBN());
+    yearIndex.erase({book.getYear(), bookID});
+    books.erase(bookID);
+    booksChanged = true;
+    appendJournal("REMOVEBOOK|" + to_string(bookID));
+    return true;
+}
+
+bool Library::addUser(unique_ptr<Member> user) {
+    unique_lock<WriterPriorityMutex> lock(catalogMutex);
+    int userID = user->getUserID();
+    if (users.find(userID) != users.end()) return false;
+    appendJournal(joinFields({"ADDUSER", to_string(userID), user->getRole(), user->getName(),
+                              user->getPassword(), user->getDepartment()}));
+    cacheAccount(make_unique<Account>(userID));
+    changedRoles[static_cast<size_t>(user->getRoleType())] = true;
+    users[userID] = move(user);
+    return true;
+}
+
+bool Library::removeUser(int userID) {
+    unique_lock<WriterPriorityMutex> lock(catalogMutex);
+    auto userIt = users.find(userID);
+    if (userIt == users.end()) return false;
+    changedRoles[static_cast<size_t>(userIt->second->getRoleType())] = true;
+    auto reservedIt = reservationsByUser.find(userID);
+    if (reservedIt != reservationsByUser.end()) {
+        for (int bookID : reservedIt->second) {
+            books.find(bookID)->cancelReservation(userID);
+        }
+        reservationsByUser.erase(reservedIt);
+    }
+    users.erase(userIt);
+    if (accounts.erase(userID) > 0) {
+        accountLru.erase(accountLruPos[userID]);
+        accountLruPos.erase(userID);
+    }
+    appendJournal("REMOVEUSER|" + to_string(userID));
+    return true;
+}
+
+bool Library::borrowBook(int userID, int bookID) {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    lock_guard<mutex> stripe(accountLock(userID));
+    return borrowBookLocked(userID, bookID);
+}
+
+// Caller holds catalogMutex and the user's account stripe. The book is not
+// locked: the account checks run first, then the book is claimed with a CAS
+// that only one of several concurrent borrowers can win.
+bool Library::borrowBookLocked(int userID, int bookID) {
+    auto userIt = users.find(userID);
+    Book* book = books.find(bookID);
+    
+    if (userIt == users.end() || !book) return false;
+    
+    if (!userIt->second->canBorrow()) return false;
+    
+    if (book->getState() == BookState::Loaned) return false;
+    
+    auto account = accountAt(userID);
+    
+    if (account->getCurrentBorrows().size() >= userIt->second->getMaxBooks()) return false;
+    
+    if (account->getTotalFine() > 0) return false;
+    
+    if (!book->tryCheckout(userID)) return false;
+    account->addBorrow(bookID);
+    BorrowRecord record = account->getCurrentBorrows().back();
+    {
+        lock_guard<mutex> loanGuard(loanMutex);
+        recordLoan(bookID, {userID, record.borrowDate, record.dueDate});
+    }
+    appendJournal("BORROW|" + to_string(userID) + "|" + to_string(bookID) + "|" +
+                  to_string(chrono::system_clock::to_time_t(record.borrowDate)) + "|" +
+                  to_string(chrono::system_clock::to_time_t(record.dueDate)));
+    return true;
+}
+
+// Returns the front of the book's reservation queue, or -1 when it is empty.
+static int nextReservation(const Book& book) {
+    const auto& queue = book.getReservationQueue();
+    return queue.empty() ? -1 : queue.front();
+}
+
+bool Library::returnBook(int userID, int bookID) {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    auto userIt = users.find(userID);
+    Book* book = books.find(bookID);
+    
+    if (userIt == users.end() || !book) return false;
+    
+    // A waiting patron is handed the book under the same locks, so their
+    // stripe has to be known up front; if the queue head changes before all
+    // the stripes are held, look again.
+    optional<StripeLock> stripes;
+    int nextUserID;
+    for (;;) {
+        {
+            lock_guard<mutex> peek(bookLock(bookID));
+            nextUserID = nextReservation(*book);
+        }
+        stripes.emplace(&bookLock(bookID), &accountLock(userID),
+                        nextUserID != -1 ? &accountLock(nextUserID) : nullptr);
+        if (nextReservation(*book) == nextUserID) break;
+        stripes.reset();
+    }
+    
+    auto loan = findLoan(bookID);
+    if (!loan || loan->userID != userID) return false;
+    
+    auto account = accountAt(userID);
+    if (!account) return false;
+    
+    auto now = chrono::system_clock::now();
+    if (now > loan->dueDate) {
+        auto overdueHours = chrono::duration_cast<chrono::hours>(now - loan->dueDate).count();
+        double fine = overdueHours * userIt->second->getFineRate();
+        if (fine > 0) {
+            account->addFine(fine);
+            appendJournal(joinFields({"FINE", to_string(userID), to_string(fine), to_string(account->getTotalFine())}));
+        }
+    }
+    
+    account->removeBorrow(bookID);
+    {
+        lock_guard<mutex> loanGuard(loanMutex);
+        dropLoan(bookID);
+    }
+    // Journaled before checkIn() publishes the book: a concurrent borrower
+    // can claim it the moment it is available, and replay drops a BORROW
+    // that comes ahead of the RETURN it depends on.
+    appendJournal("RETURN|" + to_string(userID) + "|" + to_string(bookID));
+    book->checkIn(nextUserID);
+    
+    // The next patron in the queue gets the book straight away; their BORROW
+    // record follows the RETURN in the journal. If they cannot borrow it
+    // after all, the hold is dropped and the book becomes available.
+    if (nextUserID != -1) {
+        book->getNextReservation();
+        unindexReservation(nextUserID, bookID);
+        if (!borrowBookLocked(nextUserID, bookID)) book->releaseHold(nextUserID);
+    }
+    
+    return true;
+}
+
+bool Library::authenticateUser(int userID, const string& password) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    auto it = users.find(userID);
+    return (it != users.end() && it->second->verifyPassword(password));
+}
+
+// Only a positive, finite amount is accepted: a negative one would raise the
+// fine and NaN would poison the balance.
+bool Library::payFine(int userID, double amount) {
+    if (!isfinite(amount) || amount <= 0) return false;
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    lock_guard<mutex> stripe(accountLock(userID));
+    Account* account = accountAt(userID);
+    if (!account) return false;
+    account->payFine(amount);
+    appendJournal(joinFields({"PAY", to_string(userID), to_string(amount), to_string(account->getTotalFine())}));
+    return true;
+}
+
+const Book* Library::getBook(int bookID) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    return bookAt(bookID);
+}
+
+const Member* Library::getMember(int userID) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    return memberAt(userID);
+}
+
+const Book* Library::bookAt(int bookID) const {
+    return books.find(bookID);
+}
+
+const Member* Library::memberAt(int userID) const {
+    auto it = users.find(userID);
+    return it != users.end() ? it->second.get() : nullptr;
+}
+
+Account* Library::getAccount(int userID) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    return accountAt(userID);
+}
+
+// Unlike reading it through getAccount(), this is safe while other threads
+// borrow and return on the same account.
+double Library::getOutstandingFine(int userID) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    lock_guard<mutex> stripe(accountLock(userID));
+    const Account* account = accountAt(userID);
+    return account ? account->getTotalFine() : 0.0;
+}
+
+size_t Library::getBookCount() const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    return books.size();
+}
+
+size_t Library::getUserCount() const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    return users.size();
+}
+
+// Accounts are read from their file the first time they are needed and stay
+// cached until a checkpoint finds them among the least recently used with no
+// unsaved changes. The file is parsed outside cacheMutex; if another thread
+// loaded the same account meanwhile, its copy wins.
+Account* Library::accountAt(int userID) const {
+    {
+        lock_guard<mutex> guard(cacheMutex);
+        auto it = accounts.find(userID);
+        if (it != accounts.end()) {
+            accountLru.splice(accountLru.begin(), accountLru, accountLruPos[userID]);
+            return it->second.get();
+        }
+    }
+    if (users.find(userID) == users.end()) return nullptr;
+
+    auto account = parseAccountFile(userID);
+    account->clearDirty();
+    lock_guard<mutex> guard(cacheMutex);
+    auto it = accounts.find(userID);
+    if (it != accounts.end()) return it->second.get();
+    return cacheAccount(move(account));
+}
+
+Account* Library::cacheAccount(unique_ptr<Account> account) const {
+    int userID = account->getUserID();
+    Account* cached = account.get();
+    accounts[userID] = move(account);
+    accountLru.push_front(userID);
+    accountLruPos[userID] = accountLru.begin();
+    return cached;
+}
+
+// Dirty accounts are skipped: their changes only reach the account file at
+// the next saveState(). The most recently used account is never evicted.
+// Runs under saveMutex and the exclusive catalog lock, so no caller holds an
+// account and no checkpoint is still writing an account file.
+void Library::evictIdleAccounts() const {
+    auto it = accountLru.end();
+    while (accounts.size() > accountCacheLimit && prev(it) != accountLru.begin()) {
+        --it;
+        auto accountIt = accounts.find(*it);
+        if (accountIt->second->isDirty()) continue;
+        accounts.erase(accountIt);
+        accountLruPos.erase(*it);
+        it = accountLru.erase(it);
+    }
+}
+
+void Library::setAccountCacheLimit(size_t limit) {
+    lock_guard<mutex> saveGuard(saveMutex);
+    unique_lock<WriterPriorityMutex> lock(catalogMutex);
+    accountCacheLimit = max<size_t>(limit, 16);
+    evictIdleAccounts();
+}
+
+// Every word of the query has to match a title or author word, either
+// exactly or as a prefix. Books are ranked by the sum of their best match per
+// query word: exact title word, title prefix, exact author word, author
+// prefix. An empty query lists the whole catalog.
+vector<const Book*> Library::searchBooks(const string& query) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    vector<const Book*> results;
+    vector<string> words = TokenIndex::tokenize(query);
+    if (words.empty()) {
+        results.reserve(books.size());
+        for (const Book& book : books) {
+            results.push_back(&book);
+        }
+        return results;
+    }
+
+    ScoreMap totals;
+    for (size_t i = 0; i < words.size(); i++) {
+        ScoreMap wordScores;
+        titleIndex.match(words[i], 4, 3, wordScores);
+        authorIndex.match(words[i], 2, 1, wordScores);
+        intersectScores(totals, move(wordScores), i == 0);
+        if (totals.empty()) break;
+    }
+    return rankByScore(totals);
+}
+
+// Pages through the whole catalog without materializing it: each call walks
+// the ID index from cursor and returns at most limit books.
+BookPage Library::listBooks(int cursor, size_t limit) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    BookPage page;
+    page.books.reserve(min(limit, books.size()));
+    const Book* book = books.findFrom(cursor);
+    while (book && page.books.size() < limit) {
+        page.books.push_back(book);
+        int bookID = book->getBookID();
+        book = bookID < numeric_limits<int>::max() ? books.findFrom(bookID + 1) : nullptr;
+    }
+    if (book) page.next = book->getBookID();
+    return page;
+}
+
+// Same AND-of-words search as searchBooks(), but a query word also matches
+// index words within maxDistance edits (at most 1 for words of up to four
+// letters). Closer matches and title matches rank higher.
+vector<const Book*> Library::searchBooksFuzzy(const string& query, int maxDistance) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    vector<string> words = TokenIndex::tokenize(query);
+    ScoreMap totals;
+    for (size_t i = 0; i < words.size(); i++) {
+        int distance = words[i].size() <= 4 ? min(maxDistance, 1) : maxDistance;
+        ScoreMap wordScores;
+        titleIndex.matchFuzzy(words[i], distance, 2, wordScores);
+        authorIndex.matchFuzzy(words[i], distance, 1, wordScores);
+        intersectScores(totals, move(wordScores), i == 0);
+        if (totals.empty()) break;
+    }
+    return rankByScore(totals);
+}
+
+// Keeps the books present in both maps, adding up their scores.
+void Library::intersectScores(ScoreMap& totals, ScoreMap&& wordScores, bool first) {
+    if (first) {
+        totals = move(wordScores);
+        return;
+    }
+    ScoreMap kept;
+    for (const auto& entry : totals) {
+        if (const int* score = wordScores.find(entry.first)) kept[entry.first] = entry.second + *score;
+    }
+    totals = move(kept);
+}
+
+vector<const Book*> Library::rankByScore(const ScoreMap& scores) const {
+    vector<pair<int, const Book*>> ranked;
+    ranked.reserve(scores.size());
+    for (const auto& score : scores) {
+        if (const Book* book = bookAt(score.first)) ranked.push_back({score.second, book});
+    }
+    sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return a.second->getBookID() < b.second->getBookID();
+    });
+
+    vector<const Book*> results;
+    results.reserve(ranked.size());
+    for (const auto& entry : ranked) {
+        results.push_back(entry.second);
+    }
+    return results;
+}
+
+string Library::normalizeISBN(string_view isbn) {
+    string normalized;
+    for (char c : isbn) {
+        if (c != '-' && c != ' ') normalized += static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    }
+    return normalized;
+}
+
+// Type-ahead suggestions: titles and authors starting with what has been typed.
+vector<string> Library::suggest(const string& prefix, size_t limit) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    return completions.complete(prefix, limit);
+}
+
+const Book* Library::findBookByISBN(const string& isbn) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    auto it = isbnIndex.find(normalizeISBN(isbn));
+    return it != isbnIndex.end() ? bookAt(it->second.front()) : nullptr;
+}
+
+// Fills scores with the books matching every word of text in index. Returns
+// false when text has no words, i.e. the field is not being filtered on.
+bool Library::matchAllWords(const TokenIndex& index, const string& text, ScoreMap& scores) {
+    vector<string> words = TokenIndex::tokenize(text);
+    for (size_t i = 0; i < words.size(); i++) {
+        ScoreMap wordScores;
+        index.match(words[i], 2, 1, wordScores);
+        intersectScores(scores, move(wordScores), i == 0);
+    }
+    return !words.empty();
+}
+
+// Candidates come from the most selective index available (ISBN, then the
+// text fields, then the year range) and are filtered against the rest.
+vector<const Book*> Library::findBooks(const BookQuery& query) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    vector<const Book*> results;
+    string isbn = normalizeISBN(query.isbn);
+
+    vector<ScoreMap> fieldScores;
+    const pair<const TokenIndex*, const string*> textFields[] = {
+        {&titleIndex, &query.title}, {&authorIndex, &query.author}, {&publisherIndex, &query.publisher}};
+    for (const auto& field : textFields) {
+        ScoreMap scores;
+        if (matchAllWords(*field.first, *field.second, scores)) fieldScores.push_back(move(scores));
+    }
+    sort(fieldScores.begin(), fieldScores.end(),
+         [](const auto& a, const auto& b) { return a.size() < b.size(); });
+
+    vector<int> candidates;
+    if (!isbn.empty()) {
+        auto it = isbnIndex.find(isbn);
+        if (it != isbnIndex.end()) candidates = it->second;
+    } else if (!fieldScores.empty()) {
+        for (const auto& entry : fieldScores.front()) candidates.push_back(entry.first);
+    } else {
+        auto first = yearIndex.lower_bound({query.minYear, numeric_limits<int>::min()});
+        for (auto it = first; it != yearIndex.end() && it->first <= query.maxYear; ++it) {
+            candidates.push_back(it->second);
+        }
+    }
+
+    vector<pair<int, const Book*>> ranked;
+    for (int bookID : candidates) {
+        const Book* book = bookAt(bookID);
+        if (!book || book->getYear() < query.minYear || book->getYear() > query.maxYear) continue;
+        if (!isbn.empty() && normalizeISBN(book->getISBN()) != isbn) continue;
+
+        int score = 0;
+        bool matchesAll = true;
+        for (const auto& scores : fieldScores) {
+            const int* fieldScore = scores.find(bookID);
+            if (!fieldScore) {
+                matchesAll = false;
+                break;
+            }
+            score += *fieldScore;
+        }
+        if (matchesAll) ranked.push_back({score, book});
+    }
+
+    sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        if (a.first != b.first) return a.first > b.first;
+        if (a.second->getYear() != b.second->getYear()) return a.second->getYear() < b.second->getYear();
+        return a.second->getBookID() < b.second->getBookID();
+    });
+    for (const auto& entry : ranked) {
+        results.push_back(entry.second);
+    }
+    return results;
+}
+
+bool Library::reserveBook(int userID, int bookID) {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    Book* book = books.find(bookID);
+    if (!book) return false;
+    lock_guard<mutex> stripe(bookLock(bookID));
+    // Nobody queues for a book they already have or have been handed.
+    if (book->getHolder() == userID) return false;
+    bool success = book->reserve(userID);
+    if (success) {
+        {
+            lock_guard<mutex> guard(reservationMutex);
+            reservationsByUser[userID].insert(bookID);
+        }
+        appendJournal("RESERVE|" + to_string(userID) + "|" + to_string(bookID));
+    }
+    return success;
+}
+
+bool Library::cancelReservation(int userID, int bookID) {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    Book* book = books.find(bookID);
+    if (!book) return false;
+    lock_guard<mutex> stripe(bookLock(bookID));
+    bool success = book->cancelReservation(userID);
+    if (success) {
+        unindexReservation(userID, bookID);
+        appendJournal("CANCEL|" + to_string(userID) + "|" + to_string(bookID));
+    }
+    return success;
+}
+
+void Library::unindexReservation(int userID, int bookID) {
+    lock_guard<mutex> guard(reservationMutex);
+    auto it = reservationsByUser.find(userID);
+    if (it == reservationsByUser.end()) return;
+    it->second.erase(bookID);
+    if (it->second.empty()) reservationsByUser.erase(it);
+}
+
+vector<const Book*> Library::getReservedBooks(int userID) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    vector<const Book*> reservedBooks;
+    vector<int> bookIDs;
+    {
+        lock_guard<mutex> guard(reservationMutex);
+        auto it = reservationsByUser.find(userID);
+        if (it == reservationsByUser.end()) return reservedBooks;
+        bookIDs.assign(it->second.begin(), it->second.end());
+    }
+
+    sort(bookIDs.begin(), bookIDs.end());
+    for (int bookID : bookIDs) {
+        if (const Book* book = bookAt(bookID)) reservedBooks.push_back(book);
+    }
+    return reservedBooks;
+}
+
+// Binary snapshot layout: header, then the fixed-width record arrays in the
+// order below, then the string heap that the StringRefs point into. The
+// checksum covers everything after the header.
+static const char SNAPSHOT_MAGIC[8] = {'L', 'I', 'B', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t SNAPSHOT_VERSION = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bookCount;
+    uint32_t userCount;
+    uint32_t loanCount;
+    uint32_t reservationCount;
+    uint64_t heapSize;
+    uint64_t checksum;
+};
+
+struct StringRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotBook {
+    int32_t bookID;
+    int32_t year;
+    StringRef title, author, publisher, isbn;
+    uint8_t available;
+    uint8_t padding[7];
+};
+
+struct SnapshotUser {
+    int32_t userID;
+    uint8_t role;
+    uint8_t padding[3];
+    StringRef name, password, department;
+};
+
+// Accounts are not part of the snapshot: they are read from their own files
+// on demand, and only the loan table is needed up front.
+struct SnapshotLoan {
+    int32_t bookID;
+    int32_t userID;
+    int64_t borrowTime;
+    int64_t dueTime;
+};
+
+struct SnapshotReservation {
+    int32_t bookID;
+    int32_t userID;
+};
+
+
+// Pass the previous result as hash to checksum data written in pieces.
+static uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template<typename T>
+static void appendRaw(string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static StringRef addToHeap(string& heap, string_view str) {
+    StringRef ref{static_cast<uint32_t>(heap.size()), static_cast<uint32_t>(str.size())};
+    heap += str;
+    return ref;
+}
+
+// Everything a checkpoint writes, copied out under the exclusive catalog lock
+// so that the files can be written after it has been released. The snapshot
+// records double as the source for books.txt, reservations.txt and the user
+// files; dirty accounts are formatted up front since there are few of them,
+// all into one buffer that each file takes a slice of.
+struct AccountFile {
+    int userID;
+    size_t offset;
+    size_t length;
+};
+
+struct CheckpointImage {
+    uint64_t sequence = 0;
+    bool writeBooks = false;
+    array<bool, ROLE_COUNT> writeRoles{};
+    bool writeSnapshot = false;
+    SnapshotHeader header{};
+    string bookData, userData, loanData, reservationData, heap, accountData;
+    vector<AccountFile> accountFiles;
+};
+
+// Records in the image's byte strings are copied out one at a time, since a
+// string's buffer carries no alignment guarantee for them.
+template<typename T, typename Visit>
+static void forEachRecord(const string& data, Visit&& visit) {
+    for (size_t offset = 0; offset + sizeof(T) <= data.size(); offset += sizeof(T)) {
+        T record;
+        memcpy(&record, data.data() + offset, sizeof(T));
+        visit(record);
+    }
+}
+
+template<typename T>
+static void appendNumber(string& out, T value) {
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+// Writes the files of one checkpoint through a single stream. The stream's
+// buffer is fixed and survives reopening, so a checkpoint with thousands of
+// account files doesn't allocate one per file.
+class TextFileWriter {
+public:
+    TextFileWriter() { file.rdbuf()->pubsetbuf(buffer, sizeof(buffer)); }
+
+    bool write(const string& path, string_view content) {
+        file.clear();
+        file.open(path, ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            cerr << "Error: Could not open " << path << " for writing" << endl;
+            return false;
+        }
+        file.write(content.data(), content.size());
+        file.close();
+        return static_cast<bool>(file);
+    }
+
+private:
+    char buffer[8192];
+    ofstream file;
+};
+
+// Written next to the old snapshot and renamed over it, so a crash never
+// leaves a half-written file behind.
+static bool writeSnapshotFile(const string& path, const CheckpointImage& image) {
+    const string* parts[] = {&image.bookData, &image.userData, &image.loanData, &image.reservationData, &image.heap};
+    SnapshotHeader header = image.header;
+    header.checksum = fnv1a(nullptr, 0);
+    for (const string* part : parts) header.checksum = fnv1a(part->data(), part->size(), header.checksum);
+
+    string tempPath = path + ".tmp";
+    ofstream file(tempPath, ios::binary | ios::trunc);
+    if (!file.is_open()) return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const string* part : parts) file.write(part->data(), part->size());
+    file.close();
+    if (!file) return false;
+
+    if (rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(path.c_str());
+        if (rename(tempPath.c_str(), path.c_str()) != 0) return false;
+    }
+    return true;
+}
+
+// Runs with no lock held. Keeps going after a failed file so that as much as
+// possible reaches the disk, and reports whether everything did.
+static bool writeCheckpointFiles(const CheckpointImage& image) {
+    system("mkdir data 2>nul");
+    system("mkdir data\\accounts 2>nul");
+    bool written = true;
+    TextFileWriter writer;
+    auto text = [&image](const StringRef& ref) { return string_view(image.heap.data() + ref.offset, ref.length); };
+
+    if (image.writeBooks) {
+        string bookLines;
+        bookLines.reserve(image.heap.size() + image.header.bookCount * 24);
+        forEachRecord<SnapshotBook>(image.bookData, [&](const SnapshotBook& record) {
+            appendNumber(bookLines, record.bookID);
+            bookLines += '|';
+            bookLines += text(record.title);
+            bookLines += '|';
+            bookLines += text(record.author);
+            bookLines += '|';
+            bookLines += text(record.publisher);
+            bookLines += '|';
+            appendNumber(bookLines, record.year);
+            bookLines += '|';
+            bookLines += text(record.isbn);
+            bookLines += record.available ? "|1\n" : "|0\n";
+        });
+        written &= writer.write("data/books.txt", bookLines);
+
+        string reservationLines;
+        forEachRecord<SnapshotReservation>(image.reservationData, [&](const SnapshotReservation& record) {
+            appendNumber(reservationLines, record.bookID);
+            reservationLines += '|';
+            appendNumber(reservationLines, record.userID);
+            reservationLines += '\n';
+        });
+        written &= writer.write("data/reservations.txt", reservationLines);
+    }
+
+    array<string, ROLE_COUNT> userLines;
+    forEachRecord<SnapshotUser>(image.userData, [&](const SnapshotUser& record) {
+        if (record.role >= ROLE_COUNT || !image.writeRoles[record.role]) return;
+        string& out = userLines[record.role];
+        appendNumber(out, record.userID);
+        out += '|';
+        out += text(record.name);
+        out += '|';
+        out += text(record.password);
+        out += '|';
+        out += text(record.department);
+        out += '\n';
+    });
+    for (size_t role = 0; role < ROLE_COUNT; role++) {
+        if (image.writeRoles[role]) written &= writer.write(ROLE_POLICIES[role].userFile, userLines[role]);
+    }
+
+    string path;
+    for (const AccountFile& accountFile : image.accountFiles) {
+        path.assign("data/accounts/");
+        appendNumber(path, accountFile.userID);
+        path += ".txt";
+        written &= writer.write(path, string_view(image.accountData).substr(accountFile.offset, accountFile.length));
+    }
+
+    if (image.writeSnapshot && !writeSnapshotFile("data/library.snap", image)) {
+        cerr << "Error: Could not write library.snap" << endl;
+        written = false;
+    }
+    return written;
+}
+
+void Library::captureSnapshot(CheckpointImage& image) const {
+    SnapshotHeader& header = image.header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    string& heap = image.heap;
+    image.bookData.reserve(books.size() * sizeof(SnapshotBook));
+
+    for (const Book& book : books) {
+        SnapshotBook record{};
+        record.bookID = book.getBookID();
+        record.year = book.getYear();
+        record.title = addToHeap(heap, book.getTitle());
+        record.author = addToHeap(heap, book.getAuthor());
+        record.publisher = addToHeap(heap, book.getPublisher());
+        record.isbn = addToHeap(heap, book.getISBN());
+        record.available = book.isAvailable();
+        appendRaw(image.bookData, record);
+        header.bookCount++;
+
+        for (int userID : book.getReservationQueue()) {
+            appendRaw(image.reservationData, SnapshotReservation{book.getBookID(), userID});
+            header.reservationCount++;
+        }
+    }
+
+    for (const auto& pair : users) {
+        const Member& user = *pair.second;
+        SnapshotUser record{};
+        record.userID = user.getUserID();
+        record.role = static_cast<uint8_t>(user.getRoleType());
+        record.name = addToHeap(heap, user.getName());
+        record.password = addToHeap(heap, user.getPassword());
+        record.department = addToHeap(heap, user.getDepartment());
+        appendRaw(image.userData, record);
+        header.userCount++;
+    }
+
+    for (const auto& pair : loans) {
+        SnapshotLoan record{};
+        record.bookID = pair.first;
+        record.userID = pair.second.userID;
+        record.borrowTime = chrono::system_clock::to_time_t(pair.second.borrowDate);
+        record.dueTime = chrono::system_clock::to_time_t(pair.second.dueDate);
+        appendRaw(image.loanData, record);
+        header.loanCount++;
+    }
+
+    header.heapSize = heap.size();
+    image.writeSnapshot = true;
+}
+
+bool Library::saveSnapshot(const string& path) const {
+    CheckpointImage image;
+    {
+        unique_lock<WriterPriorityMutex> lock(catalogMutex);
+        captureSnapshot(image);
+    }
+    return writeSnapshotFile(path, image);
+}
+
+// Expects saveMutex and the exclusive catalog lock. Copies out whatever
+// changed since the last checkpoint and marks it clean; the journal so far
+// moves to journal.old, which finishCheckpoint() deletes once the image is on
+// disk. Until then a restart replays journal.old and then journal.txt.
+void Library::captureCheckpoint(CheckpointImage& image) {
+    image.writeBooks = booksChanged || any_of(books.begin(), books.end(),
+        [](const Book& book) { return book.isDirty(); });
+
+    // Only the files of roles that gained, lost or modified a user are rewritten.
+    for (const auto& pair : users) {
+        if (pair.second->isDirty()) changedRoles[static_cast<size_t>(pair.second->getRoleType())] = true;
+    }
+    image.writeRoles = changedRoles;
+    bool usersChanged = any_of(changedRoles.begin(), changedRoles.end(), [](bool changed) { return changed; });
+
+    // Accounts are not in the snapshot, so it only needs rewriting when a
+    // book, user or loan changed since it was last written or loaded.
+    if (image.writeBooks || usersChanged || !snapshotCurrent) captureSnapshot(image);
+
+    for (const auto& pair : accounts) {
+        Account& account = *pair.second;
+        if (!account.isDirty()) continue;
+        string& out = image.accountData;
+        size_t offset = out.size();
+        auto appendRecord = [&out](const char* kind, const BorrowRecord& record) {
+            out += kind;
+            appendNumber(out, record.bookID);
+            out += '|';
+            appendNumber(out, chrono::system_clock::to_time_t(record.borrowDate));
+            out += '|';
+            appendNumber(out, chrono::system_clock::to_time_t(record.dueDate));
+            out += '\n';
+        };
+        for (const auto& record : account.getCurrentBorrows()) appendRecord("BORROW|", record);
+        for (const auto& record : account.getBorrowHistory()) appendRecord("HISTORY|", record);
+        // %g, as the stream formatting this replaced wrote it
+        char fine[32];
+        out += "FINE|";
+        out.append(fine, to_chars(fine, fine + sizeof(fine), account.getTotalFine(), chars_format::general, 6).ptr);
+        out += '\n';
+        image.accountFiles.push_back(AccountFile{pair.first, offset, out.size() - offset});
+        account.clearDirty();
+    }
+
+    if (image.writeBooks) {
+        for (Book& book : books) book.clearDirty();
+        booksChanged = false;
+    }
+    for (const auto& pair : users) {
+        if (changedRoles[static_cast<size_t>(pair.second->getRoleType())]) pair.second->clearDirty();
+    }
+    changedRoles.fill(false);
+    snapshotCurrent = true;
+
+    lock_guard<mutex> journalGuard(journalMutex);
+    if (journal) {
+        journal->rotate("data/journal.old");
+    } else {
+        rotateJournalFile("data/journal.txt", "data/journal.old");
+    }
+    journalRecords = 0;
+    image.sequence = ++checkpointSequence;
+    ofstream rotatedFile("data/journal.old", ios::binary | ios::app);
+    rotatedFile << "CHECKPOINT|" << image.sequence << "\n";
+}
+
+// Expects saveMutex but not the catalog lock. If a file could not be written,
+// journal.old is kept and everything in the image is marked changed again, so
+// the next checkpoint retries it; accounts in the image are still cached,
+// since only a checkpoint evicts them.
+void Library::finishCheckpoint(const CheckpointImage& image) {
+    if (writeCheckpointFiles(image)) {
+        // Recorded before journal.old goes, so that a crash in between
+        // doesn't replay records the files already include.
+        string sequence = to_string(image.sequence) + "\n";
+        if (TextFileWriter().write("data/checkpoint.txt", sequence)) remove("data/journal.old");
         return;
     }
+    unique_lock<WriterPriorityMutex> lock(catalogMutex);
+    booksChanged = booksChanged || image.writeBooks;
+    for (size_t role = 0; role < ROLE_COUNT; role++) {
+        changedRoles[role] = changedRoles[role] || image.writeRoles[role];
+    }
+    if (image.writeSnapshot) snapshotCurrent = false;
+    for (const auto& accountFile : image.accountFiles) {
+        auto it = accounts.find(accountFile.userID);
+        if (it != accounts.end()) it->second->markDirty();
+    }
+}
+
+void Library::saveState() {
+    lock_guard<mutex> saveGuard(saveMutex);
+    CheckpointImage image;
+    {
+        unique_lock<WriterPriorityMutex> lock(catalogMutex);
+        evictIdleAccounts();
+        captureCheckpoint(image);
+    }
+    finishCheckpoint(image);
+}
+
+// Read-only view of a whole file: mmap where available, a plain read elsewhere.
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+#ifndef _WIN32
+    void* mapping = MAP_FAILED;
+#else
+    vector<char> buffer;
+#endif
+
+public:
+    explicit MappedFile(const string& path) {
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                data = static_cast<const char*>(mapping);
+                size = info.st_size;
+            }
+        }
+        close(fd);
+#else
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) return;
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapping != MAP_FAILED) munmap(mapping, size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* getData() const { return data; }
+    size_t getSize() const { return size; }
+};
+
+bool Library::loadSnapshot(const string& path) {
+    MappedFile file(path);
+    const char* data = file.getData();
+    if (!data || file.getSize() < sizeof(SnapshotHeader)) return false;
+
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION) return false;
+
+    uint64_t expectedSize = sizeof(SnapshotHeader) +
+        uint64_t(header.bookCount) * sizeof(SnapshotBook) +
+        uint64_t(header.userCount) * sizeof(SnapshotUser) +
+        uint64_t(header.loanCount) * sizeof(SnapshotLoan) +
+        uint64_t(header.reservationCount) * sizeof(SnapshotReservation) +
+        header.heapSize;
+    if (file.getSize() != expectedSize) return false;
+
+    const char* body = data + sizeof(SnapshotHeader);
+    if (fnv1a(body, file.getSize() - sizeof(SnapshotHeader)) != header.checksum) return false;
+
+    const auto* bookRecords = reinterpret_cast<const SnapshotBook*>(body);
+    const auto* userRecords = reinterpret_cast<const SnapshotUser*>(bookRecords + header.bookCount);
+    const auto* loanRecords = reinterpret_cast<const SnapshotLoan*>(userRecords + header.userCount);
+    const auto* reservationRecords = reinterpret_cast<const SnapshotReservation*>(loanRecords + header.loanCount);
+    const char* heap = reinterpret_cast<const char*>(reservationRecords + header.reservationCount);
+
+    auto heapString = [heap, &header](const StringRef& ref) {
+        if (uint64_t(ref.offset) + ref.length > header.heapSize) return string();
+        return string(heap + ref.offset, ref.length);
+    };
+
+    books.reserve(books.size() + header.bookCount);
+    for (uint32_t i = 0; i < header.bookCount; i++) {
+        const SnapshotBook& record = bookRecords[i];
+        auto book = make_unique<Book>(record.bookID, heapString(record.title), heapString(record.author),
+                                      heapString(record.publisher), record.year, heapString(record.isbn));
+        book->setAvailable(record.available != 0);
+        books.insert(move(book));
+    }
+    indexBooks();
+
+    for (uint32_t i = 0; i < header.userCount; i++) {
+        const SnapshotUser& record = userRecords[i];
+        if (record.role >= ROLE_COUNT) continue;
+        auto user = createMember(static_cast<Role>(record.role), record.userID,
+                                 heapString(record.name), heapString(record.password));
+        user->setDepartment(heapString(record.department));
+        addUser(move(user));
+    }
+
+    // addUser() above cached a fresh, empty account for every user.
+    accounts.clear();
+    accountLru.clear();
+    accountLruPos.clear();
+
+    {
+        lock_guard<mutex> loanGuard(loanMutex);
+        loans.reserve(header.loanCount);
+        for (uint32_t i = 0; i < header.loanCount; i++) {
+            const SnapshotLoan& record = loanRecords[i];
+            recordLoan(record.bookID, {record.userID,
+                                       chrono::system_clock::from_time_t(record.borrowTime),
+                                       chrono::system_clock::from_time_t(record.dueTime)});
+            Book* book = books.find(record.bookID);
+            if (book) book->setState(BookState::Loaned, record.userID);
+        }
+    }
+
+    for (uint32_t i = 0; i < header.reservationCount; i++) {
+        Book* book = books.find(reservationRecords[i].bookID);
+        if (book) reserveBook(reservationRecords[i].userID, book->getBookID());
+    }
+    snapshotCurrent = true;
+    return true;
+}
+
+void Library::checkpoint() {
+    lock_guard<mutex> saveGuard(saveMutex);
+    CheckpointImage image;
+    {
+        unique_lock<WriterPriorityMutex> lock(catalogMutex);
+        evictIdleAccounts();
+        size_t pending;
+        {
+            lock_guard<mutex> journalGuard(journalMutex);
+            pending = journalRecords;
+        }
+        if (pending < JOURNAL_COMPACT_THRESHOLD) return;
+        captureCheckpoint(image);
+    }
+    finishCheckpoint(image);
+}
+
+void Library::appendJournal(const string& record) {
+    lock_guard<mutex> journalGuard(journalMutex);
+    if (!journalEnabled) return;
+    if (!journal) {
+        journal = make_unique<JournalWriter>("data/journal.txt", journalCommitInterval, journalBatchSize);
+    }
+    journal->append(record);
+    journalRecords++;
+}
+
+// Batch jobs switch the journal off and call saveState() at their own
+// checkpoints instead.
+void Library::setJournaling(bool enabled) {
+    lock_guard<mutex> journalGuard(journalMutex);
+    journalEnabled = enabled;
+}
+
+// The writer is never replaced once created, so it can be synced without
+// holding journalMutex and blocking other appenders.
+void Library::sync() {
+    JournalWriter* writer;
+    {
+        lock_guard<mutex> journalGuard(journalMutex);
+        writer = journal.get();
+    }
+    if (writer) writer->sync();
+}
+
+void Library::setCommitPolicy(chrono::milliseconds interval, size_t batchSize) {
+    lock_guard<mutex> journalGuard(journalMutex);
+    journalCommitInterval = interval;
+    journalBatchSize = batchSize;
+    if (journal) journal->setCommitPolicy(interval, batchSize);
+}
+
+void Library::markClean() {
+    for (Book& book : books) book.clearDirty();
+    for (const auto& pair : users) pair.second->clearDirty();
+    for (const auto& pair : accounts) pair.second->clearDirty();
+    booksChanged = false;
+    changedRoles.fill(false);
+}
+
+// Expects the data files to have just been loaded: everything in memory is
+// marked clean first, so only what the journal touches is saved again.
+// Records in journal.old up to the CHECKPOINT marker of a checkpoint that
+// finished writing are already in the files and are skipped. Those of a
+// checkpoint that failed part way may be in some files and not others, so
+// applyJournalRecord() skips what the state already reflects. Malformed records are skipped with a warning. A last line without its
+// newline is a record torn by a crash mid-flush; it is dropped and cut off
+// the file, so that new records don't get appended onto it.
+void Library::replayJournal() {
+    markClean();
+    journalEnabled = false;
+    journalRecords = 0;
+    uint64_t completedCheckpoint = 0;
+    string completed;
+    if (readWholeFile("data/checkpoint.txt", completed)) {
+        from_chars(completed.data(), completed.data() + completed.size(), completedCheckpoint);
+    }
+    checkpointSequence = completedCheckpoint;
+
+    // journal.old holds the records of a checkpoint that never finished writing.
+    for (const char* journalPath : {"data/journal.old", "data/journal.txt"}) {
+        string content;
+        if (readWholeFile(journalPath, content)) {
+            size_t complete = content.rfind('\n');
+            complete = (complete == string::npos) ? 0 : complete + 1;
+            if (complete < content.size()) {
+                cerr << "Warning: dropping incomplete record at the end of " << journalPath << ": "
+                     << content.substr(complete) << endl;
+                content.resize(complete);
+                error_code error;
+                filesystem::resize_file(journalPath, complete, error);
+            }
+
+            // Numbering continues past the last checkpoint seen, even one
+            // that never finished.
+            size_t start = 0;
+            for (size_t pos = 0; pos < content.size();) {
+                size_t eol = content.find('\n', pos);
+                RecordFields parts(string_view(content.data() + pos, eol - pos), '|');
+                pos = eol + 1;
+                uint64_t sequence;
+                if (parts.size() == 2 && parts[0] == "CHECKPOINT" && parts.tryNumber(1, sequence)) {
+                    checkpointSequence = max(checkpointSequence, sequence);
+                    if (sequence <= completedCheckpoint) start = pos;
+                }
+            }
+
+            size_t lineNumber = count(content.begin(), content.begin() + start, '\n');
+            for (size_t pos = start; pos < content.size();) {
+                size_t eol = content.find('\n', pos);
+                string_view line(content.data() + pos, eol - pos);
+                pos = eol + 1;
+                lineNumber++;
+                if (line.empty() || line == "\r") continue;
+                if (!applyJournalRecord(RecordFields(line, '|'))) {
+                    cerr << "Warning: skipping malformed record " << lineNumber << " of " << journalPath << ": "
+                         << line << endl;
+                    continue;
+                }
+                journalRecords++;
+            }
+        }
+    }
+    journalEnabled = true;
+}
+
+// Records are applied directly to the entities rather than through the public
+// operations, so replay neither re-validates nor re-journals them. BORROW and
+// RETURN are skipped when the state already reflects them, as is a RESERVE
+// by the book's holder or by someone already queued, and FINE and PAY carry
+// the resulting balance, which keeps a replay over a freshly written
+// snapshot harmless. Returns false for a record that doesn't parse.
+bool Library::applyJournalRecord(const RecordFields& parts) {
+    if (parts.size() < 2) return false;
+    string_view type = parts[0];
+    int first, second;
+    bool idFields = parts.tryNumber(1, first) && (parts.size() < 3 || parts.tryNumber(2, second));
+
+    if (type == "BORROW" && parts.size() == 5) {
+        time_t borrowTime, dueTime;
+        if (!idFields || !parts.tryNumber(3, borrowTime) || !parts.tryNumber(4, dueTime)) return false;
+        Account* account = getAccount(first);
+        Book* book = books.find(second);
+        // A patron only borrows a book they reserved once it has been handed
+        // to them off the queue, so a reservation replay put back is stale.
+        if (book && book->isReservedBy(first)) cancelReservation(first, second);
+        if (!account || !book || !book->isAvailable()) return true;
+
+        BorrowRecord record;
+        record.bookID = book->getBookID();
+        record.borrowDate = chrono::system_clock::from_time_t(borrowTime);
+        record.dueDate = chrono::system_clock::from_time_t(dueTime);
+        account->addBorrow(record);
+        {
+            lock_guard<mutex> loanGuard(loanMutex);
+            recordLoan(record.bookID, {account->getUserID(), record.borrowDate, record.dueDate});
+        }
+        book->setState(BookState::Loaned, account->getUserID());
+    }
+    else if (type == "RETURN" && parts.size() == 3) {
+        if (!idFields) return false;
+        Account* account = getAccount(first);
+        Book* book = books.find(second);
+        if (!account || !book) return true;
+
+        int bookID = book->getBookID();
+        auto loan = findLoan(bookID);
+        if (!loan || loan->userID != account->getUserID()) return true;
+
+        account->removeBorrow(bookID);
+        {
+            lock_guard<mutex> loanGuard(loanMutex);
+            dropLoan(bookID);
+        }
+        book->setAvailable(true);
+        if (book->isReserved()) {
+            unindexReservation(book->getNextReservation(), bookID);
+        }
+    }
+    else if ((type == "FINE" || type == "PAY") && (parts.size() == 3 || parts.size() == 4)) {
+        // Older records have no balance field and are applied as a delta.
+        double amount, balance;
+        if (!parts.tryNumber(1, first) || !parts.tryNumber(2, amount)) return false;
+        if (parts.size() == 4 && !parts.tryNumber(3, balance)) return false;
+        Account* account = getAccount(first);
+        if (!account) return true;
+        if (parts.size() == 4) account->setTotalFine(balance);
+        else if (type == "FINE") account->addFine(amount);
+        else account->payFine(amount);
+    }
+    else if (type == "RESERVE" && parts.size() == 3) {
+        if (!idFields) return false;
+        // A reservation that has since been handed off ends with the patron
+        // holding the book; Book::reserve() already refuses a second one.
+        auto loan = findLoan(second);
+        if (!loan || loan->userID != first) reserveBook(first, second);
+    }
+    else if (type == "CHECKPOINT" && parts.size() == 2) {
+        // Marks where a checkpoint rotated the journal; replayJournal()
+        // reads it, there is nothing to apply.
+        uint64_t sequence;
+        if (!parts.tryNumber(1, sequence)) return false;
+    }
+    else if (type == "CANCEL" && parts.size() == 3) {
+        if (!idFields) return false;
+        cancelReservation(first, second);
+    }
+    else if (type == "ADDBOOK" && parts.size() == 7) {
+        int year;
+        if (!parts.tryNumber(1, first) || !parts.tryNumber(5, year)) return false;
+        addBook(make_unique<Book>(first, parts.str(2), parts.str(3), parts.str(4), year, parts.str(6)));
+    }
+    else if (type == "REMOVEBOOK" && parts.size() == 2) {
+        if (!idFields) return false;
+        removeBook(first);
+    }
+    else if (type == "ADDUSER" && parts.size() == 6) {
+        auto role = parseRole(parts[2]);
+        if (!parts.tryNumber(1, first) || !role) return false;
+        auto user = createMember(*role, first, parts.str(3), parts.str(4));
+        user->setDepartment(parts.str(5));
+        addUser(move(user));
+    }
+    else if (type == "REMOVEUSER" && parts.size() == 2) {
+        if (!idFields) return false;
+        removeUser(first);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+void Library::loadState() {
+    cout << "Loading state..." << endl;
+    
+    journalEnabled = false;
+    snapshotCurrent = false;
+    books.clear();
+    titleIndex.clear();
+    authorIndex.clear();
+    publisherIndex.clear();
+    completions.clear();
+    isbnIndex.clear();
+    yearIndex.clear();
+    users.clear();
+    accounts.clear();
+    accountLru.clear();
+    accountLruPos.clear();
+    loans.clear();
+    dueIndex.clear();
+    overdueHorizon = {};
+    overdueRates.clear();
+    overdueRateSum = 0.0;
+    overdueWeightedDue = 0.0;
+    reservationsByUser.clear();
+
+    if (loadSnapshot("data/library.snap")) {
+        cout << "Loaded snapshot: " << books.size() << " books, " << users.size() << " users" << endl;
+    } else {
+        cout << "Loading text files..." << endl;
+        loadTextFiles();
+        cout << "Loaded " << books.size() << " books, " << users.size() << " users" << endl;
+    }
+
+    cout << "Replaying journal..." << endl;
+    replayJournal();
+    cout << "Replayed " << journalRecords << " journal records" << endl;
+    cout << "State loading complete" << endl;
+}
+
+static unsigned loaderThreads() {
+    return max(1u, thread::hardware_concurrency());
+}
+
+// Cuts the file contents into line-aligned chunks of at least 64 KiB and
+// parses each chunk on its own thread. parseLine must not throw; it returns
+// null for lines it rejects, which are counted in skipped. The results come
+// back in file order.
+template<typename T, typename ParseLine>
+static vector<unique_ptr<T>> parseLinesParallel(const string& content, ParseLine parseLine, size_t& skipped) {
+    const size_t minChunk = 64 * 1024;
+    size_t chunkSize = max(minChunk, content.size() / loaderThreads() + 1);
+
+    vector<pair<size_t, size_t>> chunks;
+    for (size_t begin = 0; begin < content.size();) {
+        size_t end = content.find('\n', min(content.size(), begin + chunkSize));
+        end = (end == string::npos) ? content.size() : end + 1;
+        chunks.push_back({begin, end});
+        begin = end;
+    }
+
+    vector<vector<unique_ptr<T>>> results(chunks.size());
+    vector<size_t> rejected(chunks.size());
+    auto parseChunk = [&](size_t index) {
+        size_t pos = chunks[index].first;
+        size_t chunkEnd = chunks[index].second;
+        while (pos < chunkEnd) {
+            size_t eol = content.find('\n', pos);
+            if (eol == string::npos || eol > chunkEnd) eol = chunkEnd;
+            string_view line(content.data() + pos, eol - pos);
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            pos = eol + 1;
+            if (line.empty()) continue;
+            if (auto item = parseLine(line)) results[index].push_back(move(item));
+            else rejected[index]++;
+        }
+    };
+
+    vector<thread> workers;
+    for (size_t i = 1; i < chunks.size(); i++) workers.emplace_back(parseChunk, i);
+    if (!chunks.empty()) parseChunk(0);
+    for (auto& worker : workers) worker.join();
+
+    for (size_t count : rejected) skipped += count;
+    vector<unique_ptr<T>> merged;
+    for (auto& chunk : results) {
+        for (auto& item : chunk) merged.push_back(move(item));
+    }
+    return merged;
+}
+
+static void warnSkipped(const string& filename, size_t skipped) {
+    if (skipped > 0) cerr << "Warning: skipped " << skipped << " malformed lines in " << filename << endl;
+}
+
+// Parallel import of the text files: books.txt and the user files are parsed
+// in chunks, then a pool of workers reads the account files concurrently to
+// rebuild the loan table. Only the final merge runs on the calling thread.
+// Malformed lines are skipped and counted rather than stopping the load.
+void Library::loadTextFiles() {
+    string content;
+    if (readWholeFile("data/books.txt", content)) {
+        size_t skipped = 0;
+        auto loaded = parseLinesParallel<Book>(content, [](string_view line) {
+            RecordFields parts(line, '|');
+            int bookID, year;
+            if (parts.size() != 7 || !parts.tryNumber(0, bookID) || !parts.tryNumber(4, year)) {
+                return unique_ptr<Book>();
+            }
+            auto book = make_unique<Book>(bookID, parts.str(1), parts.str(2), parts.str(3), year, parts.str(5));
+            book->setAvailable(parts[6] == "1");
+            return book;
+        }, skipped);
+        warnSkipped("data/books.txt", skipped);
+        books.reserve(books.size() + loaded.size());
+        for (auto& book : loaded) books.insert(move(book));
+        indexBooks();
+    }
+
+    vector<int> userIDs;
+    for (size_t i = 0; i < ROLE_COUNT; i++) {
+        Role role = static_cast<Role>(i);
+        if (!readWholeFile(rolePolicy(role).userFile, content)) continue;
+        size_t skipped = 0;
+        auto loaded = parseLinesParallel<Member>(content, [role](string_view line) {
+            RecordFields parts(line, '|');
+            int userID;
+            if (parts.size() != 4 || !parts.tryNumber(0, userID)) return unique_ptr<Member>();
+            auto user = createMember(role, userID, parts.str(1), parts.str(2));
+            user->setDepartment(parts.str(3));
+            return user;
+        }, skipped);
+        warnSkipped(rolePolicy(role).userFile, skipped);
+        users.reserve(users.size() + loaded.size());
+        for (auto& user : loaded) {
+            int userID = user->getUserID();
+            if (addUser(move(user))) userIDs.push_back(userID);
+        }
+    }
+
+    vector<unique_ptr<Account>> loadedAccounts(userIDs.size());
+    atomic<size_t> nextAccount{0};
+    auto accountWorker = [&]() {
+        for (size_t i; (i = nextAccount++) < userIDs.size();) {
+            loadedAccounts[i] = parseAccountFile(userIDs[i]);
+        }
+    };
+    vector<thread> workers;
+    size_t workerCount = min<size_t>(loaderThreads(), userIDs.size());
+    for (size_t i = 1; i < workerCount; i++) workers.emplace_back(accountWorker);
+    accountWorker();
+    for (auto& worker : workers) worker.join();
+
+    // The accounts themselves are loaded again on demand; only their loans
+    // stay resident.
+    {
+        lock_guard<mutex> loanGuard(loanMutex);
+        for (const auto& account : loadedAccounts) {
+            for (const auto& record : account->getCurrentBorrows()) {
+                recordLoan(record.bookID, {account->getUserID(), record.borrowDate, record.dueDate});
+                Book* book = books.find(record.bookID);
+                if (book) book->setState(BookState::Loaned, account->getUserID());
+            }
+        }
+    }
+    accounts.clear();
+    accountLru.clear();
+    accountLruPos.clear();
+
+    size_t skipped = 0;
+    readDataFile("data/reservations.txt", [this, &skipped](const RecordFields& parts) {
+        int bookID, userID;
+        if (parts.size() == 2 && parts.tryNumber(0, bookID) && parts.tryNumber(1, userID)) {
+            reserveBook(userID, bookID);
+        } else if (parts.size() > 1 || parts[0].find_first_not_of(" \t\r") != string_view::npos) {
+            skipped++;
+        }
+    });
+    warnSkipped("data/reservations.txt", skipped);
+}
+
+// Drops any cached copy so the account is read from its file again.
+void Library::loadAccountInfo(int userID) {
+    lock_guard<mutex> saveGuard(saveMutex);
+    unique_lock<WriterPriorityMutex> lock(catalogMutex);
+    auto it = accounts.find(userID);
+    if (it != accounts.end() && !it->second->isDirty()) {
+        accounts.erase(it);
+        accountLru.erase(accountLruPos[userID]);
+        accountLruPos.erase(userID);
+    }
+    accountAt(userID);
+}
 
+// Only reads the account file, so it is safe to run for several users at once.
+// Malformed lines are skipped with a warning; nothing here throws.
+unique_ptr<Account> Library::parseAccountFile(int userID) {
+    string accountPath = "data/accounts/" + to_string(userID) + ".txt";
     auto account = make_unique<Account>(userID);
+    ifstream file(accountPath);
+    if (!file.is_open()) return account;
+
     string line;
+    size_t skipped = 0;
     while (getline(file, line)) {
-        auto parts = split(line, '|');
+        RecordFields parts(line, '|');
         if (parts.size() < 2) continue;
 
-        if (parts[0] == "BORROW") {
-            int bookID = stoi(parts[1]);
-            time_t borrowTime = stoll(parts[2]);
-            time_t dueTime = stoll(parts[3]);
-            
+        if ((parts[0] == "BORROW" || parts[0] == "HISTORY") && parts.size() >= 4) {
             BorrowRecord record;
-            record.bookID = bookID;
-            record.borrowDate = chrono::system_clock::from_time_t(borrowTime);
-            record.dueDate = chrono::system_clock::from_time_t(dueTime);
-            
-            account->addBorrow(bookID);
-            
-            if (auto book = const_cast<Book*>(getBook(bookID))) {
-                book->setAvailable(false);
+            time_t borrowTime, dueTime;
+            if (!parts.tryNumber(1, record.bookID) || !parts.tryNumber(2, borrowTime) || !parts.tryNumber(3, dueTime)) {
+                skipped++;
+                continue;
             }
-        }
-        else if (parts[0] == "HISTORY") {
-            int bookID = stoi(parts[1]);
-            time_t borrowTime = stoll(parts[2]);
-            time_t dueTime = stoll(parts[3]);
-            
-            BorrowRecord record;
-            record.bookID = bookID;
             record.borrowDate = chrono::system_clock::from_time_t(borrowTime);
             record.dueDate = chrono::system_clock::from_time_t(dueTime);
-            
-            account->addToBorrowHistory(record);
+
+            if (parts[0] == "BORROW") account->addBorrow(record);
+            else account->addToBorrowHistory(record);
         }
         else if (parts[0] == "FINE") {
-            double fine = stod(parts[1]);
-            account->addFine(fine);
+            double amount;
+            if (!parts.tryNumber(1, amount)) {
+                skipped++;
+                continue;
+            }
+            account->addFine(amount);
         }
     }
+    warnSkipped(accountPath, skipped);
     
-    accounts[userID] = move(account);
-    file.close();
+    return account;
 }
 
-vector<string> Library::split(const string& str, char delim) {
-    vector<string> tokens;
-    string token;
-    istringstream tokenStream(str);
-    while (getline(tokenStream, token, delim)) {
-        tokens.push_back(token);
+optional<LoanSummary> Library::findLoan(int bookID) const {
+    lock_guard<mutex> loanGuard(loanMutex);
+    auto it = loans.find(bookID);
+    if (it == loans.end()) return nullopt;
+    return it->second;
+}
+
+static double hoursSinceEpoch(chrono::system_clock::time_point time) {
+    return chrono::duration<double, ratio<3600>>(time.time_since_epoch()).count();
+}
+
+// recordLoan, dropLoan, markOverdue and collectLoans expect loanMutex to be held.
+void Library::recordLoan(int bookID, const LoanSummary& loan) {
+    dropLoan(bookID);
+    loans[bookID] = loan;
+    dueIndex.insert({loan.dueDate, bookID});
+    // Loans replayed or loaded after a tick may already be past the horizon.
+    if (loan.dueDate <= overdueHorizon) markOverdue(bookID, loan);
+}
+
+void Library::dropLoan(int bookID) {
+    auto loanIt = loans.find(bookID);
+    if (loanIt == loans.end()) return;
+
+    dueIndex.erase({loanIt->second.dueDate, bookID});
+    auto rateIt = overdueRates.find(bookID);
+    if (rateIt != overdueRates.end()) {
+        overdueRateSum -= rateIt->second;
+        overdueWeightedDue -= rateIt->second * hoursSinceEpoch(loanIt->second.dueDate);
+        overdueRates.erase(rateIt);
+    }
+    loans.erase(loanIt);
+}
+
+// The rate is remembered per loan so the totals can be unwound exactly when
+// the book comes back, even if the borrower has since been removed.
+void Library::markOverdue(int bookID, const LoanSummary& loan) {
+    double rate = loanFineRate(loan);
+    overdueRates[bookID] = rate;
+    overdueRateSum += rate;
+    overdueWeightedDue += rate * hoursSinceEpoch(loan.dueDate);
+}
+
+double Library::loanFineRate(const LoanSummary& loan) const {
+    const Member* member = memberAt(loan.userID);
+    return member ? member->getFineRate() : 0.0;
+}
+
+vector<BorrowInfo> Library::collectLoans(set<pair<chrono::system_clock::time_point, int>>::const_iterator first,
+                                         set<pair<chrono::system_clock::time_point, int>>::const_iterator last) const {
+    vector<BorrowInfo> result;
+    for (; first != last; ++first) {
+        const LoanSummary& loan = loans.at(first->second);
+        const Member* user = memberAt(loan.userID);
+        const Book* book = bookAt(first->second);
+        if (!user || !book) continue;
+        result.push_back({book, user, loan.borrowDate, loan.dueDate});
+    }
+    return result;
+}
+
+vector<BorrowInfo> Library::tickOverdue(chrono::system_clock::time_point now) {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    lock_guard<mutex> loanGuard(loanMutex);
+    if (now <= overdueHorizon) return {};
+
+    // Only the loans that fell due since the previous tick are visited.
+    auto first = dueIndex.upper_bound({overdueHorizon, numeric_limits<int>::max()});
+    auto last = dueIndex.upper_bound({now, numeric_limits<int>::max()});
+    for (auto it = first; it != last; ++it) {
+        markOverdue(it->second, loans.at(it->second));
+    }
+    overdueHorizon = now;
+    return collectLoans(first, last);
+}
+
+vector<BorrowInfo> Library::getOverdueLoans(chrono::system_clock::time_point now) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    lock_guard<mutex> loanGuard(loanMutex);
+    return collectLoans(dueIndex.begin(), dueIndex.upper_bound({now, numeric_limits<int>::max()}));
+}
+
+vector<BorrowInfo> Library::getLoansDueWithin(int days, chrono::system_clock::time_point now) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    lock_guard<mutex> loanGuard(loanMutex);
+    auto first = dueIndex.upper_bound({now, numeric_limits<int>::max()});
+    auto last = dueIndex.upper_bound({now + chrono::hours(24 * days), numeric_limits<int>::max()});
+    return collectLoans(first, last);
+}
+
+// Fines accrued so far on loans that are still out, pro-rated to the second.
+// Loans behind the last tick come from the running totals; only those that
+// fell due since then are added individually.
+double Library::getAccruedLiability(chrono::system_clock::time_point now) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    lock_guard<mutex> loanGuard(loanMutex);
+    double total = 0.0;
+    auto first = dueIndex.begin();
+    if (now >= overdueHorizon) {
+        total = overdueRateSum * hoursSinceEpoch(now) - overdueWeightedDue;
+        first = dueIndex.upper_bound({overdueHorizon, numeric_limits<int>::max()});
+    }
+    auto last = dueIndex.upper_bound({now, numeric_limits<int>::max()});
+    for (auto it = first; it != last; ++it) {
+        total += loanFineRate(loans.at(it->second)) * (hoursSinceEpoch(now) - hoursSinceEpoch(it->first));
     }
-    return tokens;
+    return max(total, 0.0);
 }
 
-vector<BorrowInfo> Library::getAllBorrowedBooks() const {
+vector<BorrowInfo> Library::getAllBorrowedBooks(LoanOrder order) const {
     vector<BorrowInfo> borrowedBooks;
+    {
+        lock_guard<mutex> loanGuard(loanMutex);
+        borrowedBooks.reserve(loans.size());
+    }
     
-    for (const auto& pair : accounts) {
-        const Member* user = getMember(pair.first);
-        if (!user) continue;
-        
-        for (const auto& borrow : pair.second->getCurrentBorrows()) {
-            const Book* book = getBook(borrow.bookID);
-            if (!book) continue;
-            
-            borrowedBooks.push_back({
-                book,
-                user,
-                borrow.borrowDate,
-                borrow.dueDate
-            });
-        }
+    forEachLoan([&borrowedBooks](const Book& book, const Member& user, const LoanSummary& loan) {
+        borrowedBooks.push_back({&book, &user, loan.borrowDate, loan.dueDate});
+    });
+    
+    if (order == LoanOrder::ByDueDate) {
+        sort(borrowedBooks.begin(), borrowedBooks.end(), [](const BorrowInfo& a, const BorrowInfo& b) {
+            if (a.dueDate != b.dueDate) return a.dueDate < b.dueDate;
+            return a.book->getBookID() < b.book->getBookID();
+        });
+    } else if (order == LoanOrder::ByBorrower) {
+        sort(borrowedBooks.begin(), borrowedBooks.end(), [](const BorrowInfo& a, const BorrowInfo& b) {
+            if (a.borrower->getUserID() != b.borrower->getUserID()) {
+                return a.borrower->getUserID() < b.borrower->getUserID();
+            }
+            return a.dueDate < b.dueDate;
+        });
     }
     return borrowedBooks;
 }
@@ -5,8 +5,26 @@
 #include <vector>
 #include <memory>
 #include <queue>
+#include <list>
 #include <unordered_map>
+#include <map>
+#include <set>
+#include <limits>
+#include <unordered_set>
 #include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <array>
+#include <optional>
+#include <atomic>
+#include <string_view>
+#include <charconv>
+#include <stdexcept>
 
 using namespace std;
 
@@ -25,34 +43,302 @@ struct BorrowInfo {
     chrono::system_clock::time_point dueDate;
 };
 
+enum class LoanOrder {
+    Unordered,
+    ByDueDate,
+    ByBorrower
+};
+
+// Held means the book has come back and is set aside for the next patron in
+// its reservation queue.
+enum class BookState : uint32_t {
+    Available,
+    Loaned,
+    Held
+};
+
+// Splits one record into fields that view the caller's line buffer, so they
+// stay valid only until that buffer changes. Up to MAX_FIELDS fields are kept;
+// size() still counts them all, so a record with too many fields fails the
+// callers' field-count checks. A trailing '\r' is dropped.
+class RecordFields {
+public:
+    static constexpr size_t MAX_FIELDS = 8;
+
+    RecordFields() = default;
+    RecordFields(string_view line, char delimiter);
+
+    size_t size() const { return count; }
+    string_view operator[](size_t index) const { return fields[index]; }
+    string str(size_t index) const { return string(fields[index]); }
+
+    // Parses the whole field as a number, ignoring surrounding whitespace.
+    // number() throws invalid_argument like stoi does when it isn't one;
+    // tryNumber() returns false instead, for code that must not throw, such
+    // as the loader threads.
+    template<typename T>
+    T number(size_t index) const;
+    template<typename T>
+    bool tryNumber(size_t index, T& value) const;
+
+private:
+    array<string_view, MAX_FIELDS> fields;
+    size_t count = 0;
+};
+
+template<typename T>
+bool RecordFields::tryNumber(size_t index, T& value) const {
+    string_view field = fields[index];
+    size_t first = field.find_first_not_of(" \t\r");
+    if (first == string_view::npos) return false;
+    field = field.substr(first, field.find_last_not_of(" \t\r") - first + 1);
+    const char* end = field.data() + field.size();
+    auto result = from_chars(field.data(), end, value);
+    return result.ec == errc() && result.ptr == end;
+}
+
+template<typename T>
+T RecordFields::number(size_t index) const {
+    T value{};
+    if (!tryNumber(index, value)) throw invalid_argument("bad numeric field");
+    return value;
+}
+
+// Handle to a string in the process-wide StringPool. Equal strings share one
+// handle, so copying or comparing it costs no more than a pointer. The
+// default handle is the empty string.
+class InternedString {
+public:
+    InternedString() = default;
+    explicit InternedString(string_view text);
+
+    string_view view() const;
+    string str() const { return string(view()); }
+    bool operator==(const InternedString& other) const { return data == other.data; }
+    bool operator!=(const InternedString& other) const { return data != other.data; }
+
+private:
+    // Length prefix followed by the characters, inside a pool block
+    const char* data = nullptr;
+};
+
+// Append-only arena of distinct strings plus a hash table for finding the
+// copy already there. Entries are never freed or moved, so handles stay valid
+// for the life of the process and can be read without locking; interning
+// itself is serialized so the parallel loaders can share the pool.
+class StringPool {
+public:
+    static StringPool& instance();
+
+    const char* intern(string_view text);
+    size_t size() const;
+    size_t bytes() const;
+
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    mutable mutex poolMutex;
+    vector<unique_ptr<char[]>> blocks;
+    char* block = nullptr;
+    size_t blockUsed = 0;
+    size_t arenaBytes = 0;
+    unordered_set<string_view> entries;
+
+    StringPool() = default;
+    char* allocate(size_t size);
+};
+
+struct PoolStats {
+    size_t allocations;
+    size_t reused;
+    size_t live;
+    size_t blocks;
+    size_t bytes;
+};
+
+// Size-class allocator behind the entities' class-specific operator new and
+// delete. Objects are carved from 64 KiB blocks and freed ones go on a free
+// list for their size, so loading and reloading the catalog reuses memory
+// instead of calling malloc and free for every object. Blocks are kept for
+// the life of the process; sizes above MAX_SIZE go straight to the heap.
+class EntityPool {
+public:
+    static void* allocate(size_t size);
+    static void release(void* ptr, size_t size);
+    static PoolStats stats();
+
+private:
+    static constexpr size_t GRANULE = 16;
+    static constexpr size_t MAX_SIZE = 512;
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct SizeClass {
+        mutex lock;
+        FreeNode* freeList = nullptr;
+        char* cursor = nullptr;
+        size_t remaining = 0;
+        vector<unique_ptr<char[]>> blocks;
+        size_t allocations = 0;
+        size_t reused = 0;
+        size_t live = 0;
+    };
+
+    static array<SizeClass, MAX_SIZE / GRANULE>& sizeClasses();
+};
+
+// Standard allocator over EntityPool for the containers inside pooled
+// entities. Arrays up to the largest size class come from the pool and
+// larger ones from the heap, as for the entities themselves.
+template<typename T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(EntityPool::allocate(count * sizeof(T))); }
+    void deallocate(T* ptr, size_t count) { EntityPool::release(ptr, count * sizeof(T)); }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
 class Book {
 private:
+    // Hot fields first, so that scans over circulation state and dirty flags
+    // read one cache line per book and skip the strings.
     int bookID;
-    string title;
-    string author;
-    string publisher;
     int year;
+    // Circulation state in the high half and the user it refers to in the low
+    // half, so that claiming a book for checkout is a single compare-and-swap.
+    atomic<uint64_t> status;
+    atomic<bool> dirty;
+    // FIFO of waiting users plus each user's position in it, so membership
+    // checks and cancellations don't have to walk the queue.
+    list<int> reservationQueue;
+    unordered_map<int, list<int>::iterator> reservationPositions;
+    InternedString author;
+    InternedString publisher;
+    string title;
     string ISBN;
-    bool available;
-    queue<int> reservationQueue;
+
+    static uint64_t packStatus(BookState state, int userID);
 
 public:
     Book(int id, const string& title, const string& author, const string& publisher, int year, const string& isbn);
+    // Only for moving a book that nothing else refers to yet into storage.
+    Book(Book&& other) noexcept;
+
+    static void* operator new(size_t size) { return EntityPool::allocate(size); }
+    static void* operator new(size_t, void* place) { return place; }
+    static void operator delete(void* ptr, size_t size) { EntityPool::release(ptr, size); }
     
     int getBookID() const;
-    string getTitle() const;
-    string getAuthor() const;
-    string getPublisher() const;
+    const string& getTitle() const;
+    string_view getAuthor() const;
+    string_view getPublisher() const;
     int getYear() const;
-    string getISBN() const;
+    const string& getISBN() const;
     bool isAvailable() const;
     void setAvailable(bool status);
+    BookState getState() const;
+    int getHolder() const;
+    void setState(BookState state, int userID);
+    bool tryCheckout(int userID);
+    void checkIn(int holdFor);
+    bool releaseHold(int userID);
     
     bool reserve(int userID);
     bool cancelReservation(int userID);
     bool isReserved() const;
     int getNextReservation();
     bool isReservedBy(int userID) const;
+    const list<int>& getReservationQueue() const;
+
+    bool isDirty() const;
+    void clearDirty();
+};
+
+// Catalog storage indexed directly by book ID. Books are built in place in
+// fixed-size chunks, so their addresses never change and a full scan walks
+// memory in order. Slot occupancy is a byte array of its own, so iteration
+// skips free slots without touching the books, and any int, negative ones
+// included, can be a book ID. IDs outside the dense range go through an
+// ordered overflow map instead of growing the index.
+class BookTable {
+public:
+    class Iterator {
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = Book;
+        using difference_type = ptrdiff_t;
+        using pointer = Book*;
+        using reference = Book&;
+
+        Iterator(const BookTable* table, size_t slot);
+        Book& operator*() const { return *table->slotAt(slot); }
+        Book* operator->() const { return table->slotAt(slot); }
+        Iterator& operator++();
+        bool operator!=(const Iterator& other) const { return slot != other.slot; }
+        bool operator==(const Iterator& other) const { return slot == other.slot; }
+
+    private:
+        const BookTable* table;
+        size_t slot;
+        void skipFree();
+    };
+
+    BookTable() = default;
+    ~BookTable();
+    BookTable(const BookTable&) = delete;
+    BookTable& operator=(const BookTable&) = delete;
+
+    Book* find(int bookID) const;
+    // The book with the smallest ID at or above bookID, or null.
+    Book* findFrom(int bookID) const;
+    // Takes over the book's contents; returns null if the ID is taken.
+    Book* insert(unique_ptr<Book> book);
+    bool erase(int bookID);
+    void reserve(size_t count);
+    void clear();
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    Iterator begin() const { return Iterator(this, 0); }
+    Iterator end() const { return Iterator(this, occupied.size()); }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 1024;
+
+    struct Chunk {
+        alignas(Book) unsigned char bytes[CHUNK_SIZE * sizeof(Book)];
+    };
+
+    vector<unique_ptr<Chunk>> chunks;
+    vector<uint8_t> occupied;
+    vector<uint32_t> freeSlots;
+    // Book ID -> slot + 1, zero when absent
+    vector<uint32_t> denseIndex;
+    map<int, uint32_t> sparseIndex;
+    size_t count = 0;
+
+    Book* slotAt(size_t slot) const;
+    bool fitsDense(int bookID) const;
+};
+
+// One page of the catalog in ascending book ID order. next is the cursor for
+// the following page, or empty after the last one. Cursors are book IDs, so
+// books added or removed between calls don't shift the pages.
+struct BookPage {
+    vector<const Book*> books;
+    optional<int> next;
 };
 
 struct BorrowRecord {
@@ -61,125 +347,420 @@ struct BorrowRecord {
     chrono::system_clock::time_point dueDate;
 };
 
+// An account's loans are a handful of records, so their arrays fit the
+// EntityPool size classes and are recycled along with the account.
+using BorrowList = vector<BorrowRecord, PoolAllocator<BorrowRecord>>;
+
+// Field filters for Library::findBooks(). Empty strings and the default year
+// bounds leave a field unfiltered; text fields match word by word like
+// searchBooks(), and the ISBN ignores hyphens and spaces.
+struct BookQuery {
+    string title;
+    string author;
+    string publisher;
+    string isbn;
+    int minYear = numeric_limits<int>::min();
+    int maxYear = numeric_limits<int>::max();
+};
+
+// Resident summary of an active loan, kept for every borrowed book whether or
+// not the borrower's account is loaded.
+struct LoanSummary {
+    int userID;
+    chrono::system_clock::time_point borrowDate;
+    chrono::system_clock::time_point dueDate;
+};
+
 class Account {
 private:
     int userID;
-    vector<BorrowRecord> currentBorrows;
-    vector<BorrowRecord> borrowHistory;
+    BorrowList currentBorrows;
+    BorrowList borrowHistory;
     double totalFine;
+    bool dirty;
 
 public:
     Account(int id);
+
+    static void* operator new(size_t size) { return EntityPool::allocate(size); }
+    static void operator delete(void* ptr, size_t size) { EntityPool::release(ptr, size); }
     
+    int getUserID() const;
     void addBorrow(int bookID);
+    void addBorrow(const BorrowRecord& record);
     void removeBorrow(int bookID);
-    const vector<BorrowRecord>& getCurrentBorrows() const;
-    const vector<BorrowRecord>& getBorrowHistory() const;
+    const BorrowList& getCurrentBorrows() const;
+    const BorrowList& getBorrowHistory() const;
     double getTotalFine() const;
     void addFine(double amount);
     void payFine(double amount);
+    void setTotalFine(double amount);
     void addToBorrowHistory(const BorrowRecord& record);
+
+    bool isDirty() const;
+    void markDirty();
+    void clearDirty();
+};
+
+// Roles are a tag into ROLE_POLICIES rather than a class each, so borrow
+// checks read constants from the table and a new role is one more entry.
+// The values double as the role byte in the snapshot; only append.
+enum class Role : uint8_t {
+    Student,
+    Professor,
+    Librarian,
+    VisitingScholar
+};
+
+struct RolePolicy {
+    const char* name;
+    const char* userFile;
+    bool canBorrow;
+    bool canManageBooks;
+    bool canManageUsers;
+    int maxBooks;
+    double fineRate;
 };
 
+constexpr size_t ROLE_COUNT = 4;
+
+constexpr RolePolicy ROLE_POLICIES[ROLE_COUNT] = {
+    {"Student", "data/users/students.txt", true, false, false, 3, 10.0},
+    {"Professor", "data/users/professors.txt", true, true, false, 5, 0.0},
+    {"Librarian", "data/users/librarians.txt", false, true, true, 0, 0.0},
+    {"VisitingScholar", "data/users/visiting_scholars.txt", true, false, false, 4, 5.0},
+};
+
+constexpr const RolePolicy& rolePolicy(Role role) {
+    return ROLE_POLICIES[static_cast<size_t>(role)];
+}
+
+optional<Role> parseRole(string_view name);
+
 class Member {
 protected:
     int userID;
+    Role role;
+    bool dirty;
     string name;
     string password;
-    string department;
-    string role;
+    InternedString department;
 
 public:
-    Member(int id, const string& name, const string& password);
+    Member(int id, const string& name, const string& password, Role role);
     virtual ~Member() = default;
 
+    // The virtual destructor makes delete pass the derived class's size.
+    static void* operator new(size_t size) { return EntityPool::allocate(size); }
+    static void operator delete(void* ptr, size_t size) { EntityPool::release(ptr, size); }
+
     int getUserID() const;
-    string getName() const;
-    string getRole() const;
-    string getDepartment() const;
-    string getPassword() const { return password; }
+    const string& getName() const;
+    string_view getRole() const;
+    Role getRoleType() const { return role; }
+    const RolePolicy& getPolicy() const { return rolePolicy(role); }
+    string_view getDepartment() const;
+    const string& getPassword() const { return password; }
     void setDepartment(const string& dept);
     bool verifyPassword(const string& pwd) const { return password == pwd; }
+    bool isDirty() const;
+    void clearDirty();
 
-    virtual bool canBorrow() const = 0;
-    virtual bool canManageBooks() const = 0;
-    virtual bool canManageUsers() const = 0;
-    virtual int getMaxBooks() const = 0;
-    virtual int getMaxDays() const = 0;
-    virtual double getFineRate() const = 0;
+    bool canBorrow() const { return getPolicy().canBorrow; }
+    bool canManageBooks() const { return getPolicy().canManageBooks; }
+    bool canManageUsers() const { return getPolicy().canManageUsers; }
+    int getMaxBooks() const { return getPolicy().maxBooks; }
+    double getFineRate() const { return getPolicy().fineRate; }
 };
 
 class Student : public Member {
-private:
-    static const int MAX_BOOKS = 3;
-    static const int MAX_DAYS = 15;
-    static constexpr double FINE_RATE = 10.0;
-
 public:
     Student(int id, const string& name, const string& password);
-    
-    bool canBorrow() const override { return true; }
-    bool canManageBooks() const override { return false; }
-    bool canManageUsers() const override { return false; }
-    int getMaxBooks() const override { return MAX_BOOKS; }
-    int getMaxDays() const override { return MAX_DAYS; }
-    double getFineRate() const override { return FINE_RATE; }
 };
 
 class Professor : public Member {
-private:
-    static const int MAX_BOOKS = 5;
-    static const int MAX_DAYS = 30;
-    static constexpr double FINE_RATE = 0.0;
-    static const int MAX_OVERDUE_DAYS = 60;
-
 public:
     Professor(int id, const string& name, const string& password);
-    
-    bool canBorrow() const override { return true; }
-    bool canManageBooks() const override { return true; }
-    bool canManageUsers() const override { return false; }
-    int getMaxBooks() const override { return MAX_BOOKS; }
-    int getMaxDays() const override { return MAX_DAYS; }
-    double getFineRate() const override { return FINE_RATE; }
 };
 
 class Librarian : public Member {
 public:
     Librarian(int id, const string& name, const string& password);
-    
-    bool canBorrow() const override { return false; }
-    bool canManageBooks() const override { return true; }
-    bool canManageUsers() const override { return true; }
-    int getMaxBooks() const override { return 0; }
-    int getMaxDays() const override { return 0; }
-    double getFineRate() const override { return 0.0; }
 };
 
+// Book ID -> score accumulator for one query. Entries sit in one dense array
+// with an open-addressing index over it, so scoring another matching book
+// doesn't allocate; storage only grows by doubling.
+class ScoreMap {
+public:
+    int& operator[](int id);
+    const int* find(int id) const;
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    vector<pair<int, int>>::const_iterator begin() const { return entries.begin(); }
+    vector<pair<int, int>>::const_iterator end() const { return entries.end(); }
+
+private:
+    vector<pair<int, int>> entries;
+    // Entry index + 1 per slot, zero when empty; the size is a power of two
+    vector<uint32_t> slots;
+
+    size_t slotFor(int id) const;
+    void grow();
+};
+
+// Inverted index from lowercased words to the sorted IDs of the books whose
+// text contains them. Words are kept ordered so that a query word can also
+// match as a prefix.
+class TokenIndex {
+private:
+    map<string, vector<int>> postings;
+    // Trigram -> index words containing it, for fuzzy candidate lookup
+    unordered_map<uint32_t, vector<const string*>> trigrams;
+
+    static vector<uint32_t> trigramsOf(const string& word);
+    void addTrigrams(const string* word);
+    void removeTrigrams(const string* word);
+
+public:
+    static vector<string> tokenize(string_view text);
+
+    void add(int id, string_view text);
+    void remove(int id, string_view text);
+    void clear();
+    // Replaces the contents with the given (id, text) entries in one pass.
+    void build(const vector<pair<int, string_view>>& texts);
+    // Raises scores[id] to exactScore for entries containing word, or to
+    // prefixScore for entries that only contain a longer word starting with it.
+    void match(const string& word, int exactScore, int prefixScore, ScoreMap& scores) const;
+    void matchFuzzy(const string& word, int maxDistance, int scale, ScoreMap& scores) const;
+};
+
+// Ordered set of normalized strings (lowercased words joined by single
+// spaces) for type-ahead completion. Each key keeps the original spelling to
+// show and a count of how many entries share it, e.g. an author's books.
+// complete() may run from several threads at once; add, remove, clear and
+// build need the index to themselves.
+class PrefixIndex {
+private:
+    struct Entry {
+        string display;
+        int count;
+    };
+    using EntryRef = map<string, Entry>::const_iterator;
+    map<string, Entry> entries;
+
+    // A prefix of more than RANKED_KEYS keys keeps its best completions here
+    // once asked for, so that short prefixes don't rescan a large part of the
+    // map on every keystroke. add() keeps them up to date; remove() drops the
+    // ones it could change.
+    static constexpr size_t RANKED_KEYS = 64;
+    mutable map<string, vector<EntryRef>, less<>> rankings;
+    mutable mutex rankingMutex;
+
+    static string normalize(string_view text);
+    static bool ranksBefore(EntryRef a, EntryRef b);
+    vector<EntryRef> scan(const string& key, size_t limit) const;
+    vector<EntryRef> rank(const string& key, size_t limit) const;
+    void raiseInRankings(EntryRef changed);
+    void dropRankingsWith(EntryRef changed);
+
+public:
+    void add(string_view text);
+    void remove(string_view text);
+    void clear();
+    // Replaces the contents with the given texts in one pass.
+    void build(const vector<string_view>& texts);
+    // Up to limit completions of prefix, most shared first and then in
+    // alphabetical order.
+    vector<string> complete(const string& prefix, size_t limit) const;
+};
+
+// Writes journal records on a background thread. Records are grouped into
+// batches and flushed once per batch, either when batchSize records are
+// waiting or commitInterval has passed since the batch was started.
+class JournalWriter {
+private:
+    string path;
+    chrono::milliseconds commitInterval;
+    size_t batchSize;
+
+    deque<string> pending;
+    size_t enqueued = 0;
+    size_t committed = 0;
+    int syncWaiters = 0;
+    bool stopping = false;
+    bool reopen = false;
+
+    mutex mtx;
+    condition_variable workReady;
+    condition_variable batchCommitted;
+    thread flusher;
+
+    void run();
+
+public:
+    JournalWriter(const string& path, chrono::milliseconds commitInterval, size_t batchSize);
+    ~JournalWriter();
+
+    void append(string record);
+    void sync();
+    void rotate(const string& rotatedPath);
+    void setCommitPolicy(chrono::milliseconds interval, size_t batch);
+};
+
+struct CheckpointImage;
+
+// Reader-writer lock that lets a waiting writer in ahead of new readers.
+// glibc's shared_mutex prefers readers, so under a steady stream of lookups
+// a checkpoint or addBook() could wait indefinitely. A writer announces
+// itself before queueing on the lock; readers arriving after that wait at the
+// gate until it has been through. Readers must not take the lock shared
+// twice on one thread, since the second attempt would wait behind the writer
+// that is waiting for the first to be released.
+class WriterPriorityMutex {
+public:
+    void lock();
+    void unlock() { rw.unlock(); }
+    void lock_shared();
+    void unlock_shared() { rw.unlock_shared(); }
+
+private:
+    shared_mutex rw;
+    atomic<size_t> waitingWriters{0};
+    mutex gateMutex;
+    condition_variable gate;
+};
+
+// Library is safe to share between threads once it has been loaded (the load
+// and replay functions must run before that). catalogMutex is held shared by
+// every operation and exclusively by those that add or remove entries or save;
+// the state of an individual book or account is guarded by its lock stripe,
+// and the loan table, reservation index, account cache and journal each have
+// a mutex of their own, always taken last. Pointers handed out stay valid
+// until the entry is removed or, for accounts, evicted at a checkpoint.
 class Library {
 private:
-    unordered_map<int, unique_ptr<Book>> books;
+    static const size_t LOCK_STRIPES = 64;
+    mutable WriterPriorityMutex catalogMutex;
+    mutable array<mutex, LOCK_STRIPES> bookLocks;
+    mutable array<mutex, LOCK_STRIPES> accountLocks;
+    mutable mutex loanMutex;
+    mutable mutex reservationMutex;
+    mutable mutex cacheMutex;
+    mutable mutex journalMutex;
+    // Serializes checkpoints, which write their files after releasing
+    // catalogMutex. Taken before catalogMutex, never while holding it.
+    mutex saveMutex;
+
+    mutex& bookLock(int bookID) const { return bookLocks[static_cast<unsigned>(bookID) % LOCK_STRIPES]; }
+    mutex& accountLock(int userID) const { return accountLocks[static_cast<unsigned>(userID) % LOCK_STRIPES]; }
+
+    BookTable books;
     unordered_map<int, unique_ptr<Member>> users;
-    unordered_map<int, unique_ptr<Account>> accounts;
+    unordered_map<int, LoanSummary> loans;
+
+    // Active loans ordered by due date. Loans that fell due at or before the
+    // last tickOverdue() are also folded into running totals, so accrued
+    // liability is a constant-time sum rather than a scan of every loan.
+    set<pair<chrono::system_clock::time_point, int>> dueIndex;
+    chrono::system_clock::time_point overdueHorizon;
+    unordered_map<int, double> overdueRates;
+    double overdueRateSum = 0.0;
+    double overdueWeightedDue = 0.0;
+
+    unordered_map<int, unordered_set<int>> reservationsByUser;
+    TokenIndex titleIndex;
+    TokenIndex authorIndex;
+    TokenIndex publisherIndex;
+    PrefixIndex completions;
+    unordered_map<string, vector<int>> isbnIndex; // normalized ISBN -> ascending book IDs
+    set<pair<int, int>> yearIndex;
+
+    const Book* bookAt(int bookID) const;
+    const Member* memberAt(int userID) const;
+    Account* accountAt(int userID) const;
+    bool addBookLocked(unique_ptr<Book> book);
+    void indexBooks();
+    void indexISBN(int bookID, string_view isbn);
+    void unindexISBN(int bookID, string_view isbn);
+    bool borrowBookLocked(int userID, int bookID);
+    void captureCheckpoint(CheckpointImage& image);
+    void captureSnapshot(CheckpointImage& image) const;
+    void finishCheckpoint(const CheckpointImage& image);
+    void unindexReservation(int userID, int bookID);
+    void recordLoan(int bookID, const LoanSummary& loan);
+    void dropLoan(int bookID);
+    void markOverdue(int bookID, const LoanSummary& loan);
+    double loanFineRate(const LoanSummary& loan) const;
+    vector<BorrowInfo> collectLoans(set<pair<chrono::system_clock::time_point, int>>::const_iterator first,
+                                    set<pair<chrono::system_clock::time_point, int>>::const_iterator last) const;
+    static string normalizeISBN(string_view isbn);
+    static void intersectScores(ScoreMap& totals, ScoreMap&& wordScores, bool first);
+    vector<const Book*> rankByScore(const ScoreMap& scores) const;
+    static bool matchAllWords(const TokenIndex& index, const string& text, ScoreMap& scores);
+
+    // Accounts are loaded lazily; at each checkpoint the least recently used
+    // are evicted until no more than accountCacheLimit are resident.
+    static const size_t DEFAULT_ACCOUNT_CACHE_LIMIT = 4096;
+    mutable unordered_map<int, unique_ptr<Account>> accounts;
+    mutable list<int> accountLru;
+    mutable unordered_map<int, list<int>::iterator> accountLruPos;
+    size_t accountCacheLimit = DEFAULT_ACCOUNT_CACHE_LIMIT;
+
+    // Every mutation is appended to data/journal.txt; saveState() folds the
+    // journal back into the text files once it grows past the threshold.
+    // While a checkpoint is writing, the records it covers wait in
+    // data/journal.old, followed by a CHECKPOINT record with its sequence
+    // number. data/checkpoint.txt holds the number of the last checkpoint
+    // whose files were all written.
+    static const size_t JOURNAL_COMPACT_THRESHOLD = 1000;
+    unique_ptr<JournalWriter> journal;
+    chrono::milliseconds journalCommitInterval{100};
+    size_t journalBatchSize = 128;
+    bool journalEnabled = false;
+    size_t journalRecords = 0;
+    uint64_t checkpointSequence = 0;
+
+    // Catalog and user-file changes not tracked by the entities themselves
+    bool booksChanged = false;
+    array<bool, ROLE_COUNT> changedRoles{};
+    // Whether data/library.snap already matches the books, users and loans
+    bool snapshotCurrent = false;
 
-    static vector<string> split(const string& str, char delim);
     template<typename Func>
     void readDataFile(const string& filename, Func&& callback);
+    void appendJournal(const string& record);
+    bool applyJournalRecord(const RecordFields& parts);
+    void markClean();
+    static unique_ptr<Account> parseAccountFile(int userID);
+    Account* cacheAccount(unique_ptr<Account> account) const;
+    void evictIdleAccounts() const;
 
 public:
     Library() = default;
     ~Library();
 
     bool addBook(unique_ptr<Book> book);
+    size_t addBooks(vector<unique_ptr<Book>>& batch);
     bool removeBook(int bookID);
     const Book* getBook(int bookID) const;
     vector<const Book*> searchBooks(const string& query) const;
+    BookPage listBooks(int cursor, size_t limit) const;
+    vector<const Book*> searchBooksFuzzy(const string& query, int maxDistance = 2) const;
+    vector<const Book*> findBooks(const BookQuery& query) const;
+    const Book* findBookByISBN(const string& isbn) const;
+    vector<string> suggest(const string& prefix, size_t limit = 10) const;
+    size_t getBookCount() const;
 
     bool addUser(unique_ptr<Member> user);
     bool removeUser(int userID);
     const Member* getMember(int userID) const;
     bool authenticateUser(int userID, const string& password) const;
     Account* getAccount(int userID) const;
+    double getOutstandingFine(int userID) const;
+    size_t getUserCount() const;
+    void setAccountCacheLimit(size_t limit);
 
     bool borrowBook(int userID, int bookID);
     bool returnBook(int userID, int bookID);
@@ -187,11 +768,42 @@ public:
     bool reserveBook(int userID, int bookID);
     bool cancelReservation(int userID, int bookID);
     vector<const Book*> getReservedBooks(int userID) const;
-    vector<BorrowInfo> getAllBorrowedBooks() const;
+    optional<LoanSummary> findLoan(int bookID) const;
+    template<typename Func>
+    void forEachLoan(Func&& callback) const;
+    vector<BorrowInfo> getAllBorrowedBooks(LoanOrder order = LoanOrder::Unordered) const;
+    vector<BorrowInfo> tickOverdue(chrono::system_clock::time_point now = chrono::system_clock::now());
+    vector<BorrowInfo> getOverdueLoans(chrono::system_clock::time_point now = chrono::system_clock::now()) const;
+    vector<BorrowInfo> getLoansDueWithin(int days, chrono::system_clock::time_point now = chrono::system_clock::now()) const;
+    double getAccruedLiability(chrono::system_clock::time_point now = chrono::system_clock::now()) const;
 
-    void saveState() const;
+    void saveState();
     void loadState();
+    bool saveSnapshot(const string& path) const;
+    bool loadSnapshot(const string& path);
     void loadAccountInfo(int userID);
+    void loadTextFiles();
+    void replayJournal();
+    void checkpoint();
+    void sync();
+    void setCommitPolicy(chrono::milliseconds interval, size_t batchSize);
+    void setJournaling(bool enabled);
 };
 
+// Visits every active loan in place as (book, borrower, loan) without building
+// an intermediate list. Loans whose book or borrower no longer exists are skipped.
+// The loan table stays locked meanwhile, so the callback must not call back
+// into the library.
+template<typename Func>
+void Library::forEachLoan(Func&& callback) const {
+    shared_lock<WriterPriorityMutex> lock(catalogMutex);
+    lock_guard<mutex> loanGuard(loanMutex);
+    for (const auto& pair : loans) {
+        const Member* user = memberAt(pair.second.userID);
+        const Book* book = bookAt(pair.first);
+        if (!user || !book) continue;
+        callback(*book, *user, pair.second);
+    }
+}
+
 #endif
\ No newline at end of file
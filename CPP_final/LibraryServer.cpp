@@ -0,0 +1,605 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <atomic>
+#include <random>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "LibraryServer.h"
+
+using namespace std;
+
+static void appendBook(string& out, const Book& book) {
+    out += to_string(book.getBookID());
+    out += '|';
+    out += book.getTitle();
+    out += '|';
+    out += book.getAuthor();
+    out += '|';
+    out += book.getPublisher();
+    out += '|';
+    out += to_string(book.getYear());
+    out += '|';
+    out += book.getISBN();
+    out += book.isAvailable() ? "|1\n" : "|0\n";
+}
+
+static void replyOk(string& out, size_t lines) {
+    out += "OK|" + to_string(lines) + "\n";
+}
+
+static void replyError(string& out, const string& reason) {
+    out += "ERR|" + reason + "\n";
+}
+
+static void replyStatus(string& out, bool success, const string& reason) {
+    if (success) replyOk(out, 0);
+    else replyError(out, reason);
+}
+
+static void replyBooks(string& out, const vector<const Book*>& books, size_t limit) {
+    size_t count = min(books.size(), limit);
+    replyOk(out, count);
+    for (size_t i = 0; i < count; i++) appendBook(out, *books[i]);
+}
+
+// Runs one request against the library and appends its reply to response.
+// Malformed requests get an ERR reply rather than an exception.
+void executeCommand(Library& library, Session& session, const string& request, string& response) {
+    RecordFields fields(request, '|');
+    string_view command = fields[0];
+    size_t argc = fields.size() - 1;
+
+    try {
+        auto limitArg = [&](size_t index, size_t fallback) {
+            return argc >= index ? fields.number<size_t>(index) : fallback;
+        };
+        // The user ID in field 1, if the session may act for them.
+        auto accountArg = [&]() -> optional<int> {
+            int userID = fields.number<int>(1);
+            if (!session.trusted && session.userID != userID) return nullopt;
+            return userID;
+        };
+
+        if (command == "PING") {
+            replyOk(response, 0);
+        }
+        else if (command == "STATS") {
+            replyOk(response, 1);
+            response += to_string(library.getBookCount()) + "|" + to_string(library.getUserCount()) + "\n";
+        }
+        else if (command == "AUTH" && argc == 2) {
+            int userID = fields.number<int>(1);
+            if (!library.authenticateUser(userID, fields.str(2))) return replyError(response, "invalid credentials");
+            session.userID = userID;
+            replyOk(response, 0);
+        }
+        else if (command == "BOOK" && argc == 1) {
+            const Book* book = library.getBook(fields.number<int>(1));
+            if (!book) return replyError(response, "no such book");
+            replyOk(response, 1);
+            appendBook(response, *book);
+        }
+        else if (command == "ISBN" && argc == 1) {
+            const Book* book = library.findBookByISBN(fields.str(1));
+            if (!book) return replyError(response, "no such book");
+            replyOk(response, 1);
+            appendBook(response, *book);
+        }
+        else if (command == "SEARCH" && (argc == 1 || argc == 2)) {
+            replyBooks(response, library.searchBooks(fields.str(1)), limitArg(2, 50));
+        }
+        else if (command == "FUZZY" && (argc == 1 || argc == 2)) {
+            replyBooks(response, library.searchBooksFuzzy(fields.str(1)), limitArg(2, 50));
+        }
+        else if (command == "SUGGEST" && (argc == 1 || argc == 2)) {
+            vector<string> completions = library.suggest(fields.str(1), limitArg(2, 10));
+            replyOk(response, completions.size());
+            for (const string& completion : completions) response += completion + "\n";
+        }
+        else if (command == "BORROW" && argc == 2) {
+            auto userID = accountArg();
+            if (!userID) return replyError(response, "not authenticated");
+            replyStatus(response, library.borrowBook(*userID, fields.number<int>(2)), "borrow refused");
+        }
+        else if (command == "RETURN" && argc == 2) {
+            auto userID = accountArg();
+            if (!userID) return replyError(response, "not authenticated");
+            replyStatus(response, library.returnBook(*userID, fields.number<int>(2)), "not borrowed by this user");
+        }
+        else if (command == "RESERVE" && argc == 2) {
+            auto userID = accountArg();
+            if (!userID) return replyError(response, "not authenticated");
+            replyStatus(response, library.reserveBook(*userID, fields.number<int>(2)), "reservation refused");
+        }
+        else if (command == "CANCEL" && argc == 2) {
+            auto userID = accountArg();
+            if (!userID) return replyError(response, "not authenticated");
+            replyStatus(response, library.cancelReservation(*userID, fields.number<int>(2)), "no such reservation");
+        }
+        else if (command == "RESERVED" && argc == 1) {
+            auto userID = accountArg();
+            if (!userID) return replyError(response, "not authenticated");
+            vector<const Book*> books = library.getReservedBooks(*userID);
+            replyBooks(response, books, books.size());
+        }
+        else if (command == "LOAN" && argc == 1) {
+            auto loan = library.findLoan(fields.number<int>(1));
+            if (!loan) return replyError(response, "not on loan");
+            replyOk(response, 1);
+            response += to_string(loan->userID) + "|" +
+                        to_string(chrono::system_clock::to_time_t(loan->borrowDate)) + "|" +
+                        to_string(chrono::system_clock::to_time_t(loan->dueDate)) + "\n";
+        }
+        else if (command == "FINE" && argc == 1) {
+            auto userID = accountArg();
+            if (!userID) return replyError(response, "not authenticated");
+            if (!library.getMember(*userID)) return replyError(response, "no such user");
+            ostringstream amount;
+            amount << library.getOutstandingFine(*userID);
+            replyOk(response, 1);
+            response += amount.str() + "\n";
+        }
+        else if (command == "PAY" && argc == 2) {
+            auto userID = accountArg();
+            if (!userID) return replyError(response, "not authenticated");
+            double amount = fields.number<double>(2);
+            if (!isfinite(amount) || amount <= 0) return replyError(response, "bad amount");
+            replyStatus(response, library.payFine(*userID, amount), "no such user");
+        }
+        else {
+            replyError(response, "unknown command");
+        }
+    } catch (const exception&) {
+        replyError(response, "bad request");
+    }
+}
+
+// Executes a command stream without prompts. Replies go to stdout in request
+// order through a large buffer. The journal is off for the run; the state is
+// saved every checkpointInterval commands and once more at the end, so an
+// interrupted batch loses at most the commands since the last checkpoint.
+int runBatch(Library& library, const string& path, size_t checkpointInterval) {
+    ifstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file.is_open()) {
+            cerr << "Error: could not open " << path << endl;
+            return 1;
+        }
+    }
+    ios::sync_with_stdio(false);
+    istream& in = path == "-" ? cin : file;
+
+    library.setJournaling(false);
+    Session session;
+    session.trusted = true;
+    string line, output;
+    size_t commands = 0, failed = 0;
+    auto start = chrono::steady_clock::now();
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.find_first_not_of(" \t") == string::npos) continue;
+        if (line.find('|') == string::npos) {
+            istringstream words(line);
+            string word;
+            line.clear();
+            while (words >> word) line += (line.empty() ? "" : "|") + word;
+        }
+
+        size_t replyStart = output.size();
+        executeCommand(library, session, line, output);
+        if (output.compare(replyStart, 4, "ERR|") == 0) failed++;
+        if (output.size() >= (1 << 16)) {
+            fwrite(output.data(), 1, output.size(), stdout);
+            output.clear();
+        }
+        if (++commands % checkpointInterval == 0) library.saveState();
+    }
+    fwrite(output.data(), 1, output.size(), stdout);
+    fflush(stdout);
+
+    library.saveState();
+    library.setJournaling(true);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << commands << " commands, " << failed << " failed, " << seconds << " s" << endl;
+    return 0;
+}
+
+// Parses one catalog record: ID, title, author, publisher, year and ISBN, with
+// an optional trailing availability flag as in books.txt. The flag is ignored:
+// an imported book has no loan behind it, so it always starts out available.
+// Returns null for records that fail validation.
+static unique_ptr<Book> parseCatalogRecord(string_view line, char delimiter) {
+    RecordFields fields(line, delimiter);
+    if (fields.size() != 6 && fields.size() != 7) return nullptr;
+
+    int bookID, year;
+    if (!fields.tryNumber(0, bookID) || !fields.tryNumber(4, year) || bookID <= 0 || fields[1].empty()) return nullptr;
+
+    return make_unique<Book>(bookID, fields.str(1), fields.str(2), fields.str(3), year, fields.str(5));
+}
+
+// Streams a vendor catalog file into the library in fixed-size batches, so
+// memory stays bounded by the batch rather than the file. The journal is off
+// for the import and the catalog is saved once at the end.
+int runImport(Library& library, const string& path, char delimiter) {
+    const size_t batchSize = 10000;
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "Error: could not open " << path << endl;
+        return 1;
+    }
+
+    library.setJournaling(false);
+    vector<unique_ptr<Book>> batch;
+    batch.reserve(batchSize);
+    size_t records = 0, invalid = 0, imported = 0;
+    auto flush = [&]() {
+        imported += library.addBooks(batch);
+        batch.clear();
+    };
+
+    auto start = chrono::steady_clock::now();
+    string line;
+    while (getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        records++;
+        auto book = parseCatalogRecord(line, delimiter);
+        if (!book) {
+            invalid++;
+            continue;
+        }
+        batch.push_back(move(book));
+        if (batch.size() == batchSize) flush();
+    }
+    flush();
+    double parseSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    library.saveState();
+    library.setJournaling(true);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Records:    " << records << "\n";
+    cout << "Imported:   " << imported << "\n";
+    cout << "Duplicates: " << records - invalid - imported << "\n";
+    cout << "Invalid:    " << invalid << "\n";
+    cout << "Throughput: " << static_cast<size_t>(records / max(parseSeconds, 1e-9)) << " records/sec ("
+         << parseSeconds << " s import, " << seconds - parseSeconds << " s save)" << endl;
+    return 0;
+}
+
+#ifndef _WIN32
+
+static atomic<bool> stopRequested{false};
+
+static void requestStop(int) {
+    stopRequested = true;
+}
+
+static bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Every complete request line a connection had sent when it was read. One
+// worker answers the whole batch with a single write, so pipelining clients
+// pay one syscall per batch. The session belongs to the connection; while a
+// worker answers the batch nothing else touches it.
+struct RequestBatch {
+    int fd;
+    Session* session;
+    vector<string> requests;
+};
+
+// What the polling thread knows about a connection: the unfinished last line,
+// whether a worker is answering a batch from it, and who it has
+// authenticated as.
+struct Client {
+    string pending;
+    bool busy = false;
+    Session session;
+};
+
+// Moves the complete lines in pending into requests, skipping empty ones.
+static void takeLines(string& pending, vector<string>& requests) {
+    size_t start = 0;
+    for (size_t eol; (eol = pending.find('\n', start)) != string::npos; start = eol + 1) {
+        size_t end = (eol > start && pending[eol - 1] == '\r') ? eol - 1 : eol;
+        if (end > start) requests.push_back(pending.substr(start, end - start));
+    }
+    pending.erase(0, start);
+}
+
+// One thread polls the listener and every idle connection, and queues each
+// batch of requests for the workers. A connection leaves the poll set while
+// its batch is being answered, so replies stay in request order, and an idle
+// connection costs no worker at all. Workers hand connections back through a
+// pipe that wakes the poll. The journal is written by its own thread and
+// compaction runs on a maintenance thread.
+int runServer(Library& library, const string& socketPath, size_t workerCount) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: socket path too long: " << socketPath << endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        cerr << "Error: could not create socket: " << strerror(errno) << endl;
+        return 1;
+    }
+    unlink(socketPath.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(listener, 128) < 0) {
+        cerr << "Error: could not listen on " << socketPath << ": " << strerror(errno) << endl;
+        close(listener);
+        return 1;
+    }
+
+    int wakeup[2];
+    if (pipe(wakeup) < 0) {
+        cerr << "Error: could not create pipe: " << strerror(errno) << endl;
+        close(listener);
+        return 1;
+    }
+    fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    signal(SIGPIPE, SIG_IGN);
+
+    deque<RequestBatch> batches;
+    vector<pair<int, bool>> finished; // connection, still usable
+    mutex queueMutex;
+    condition_variable batchReady;
+
+    vector<thread> workers;
+    for (size_t i = 0; i < max<size_t>(workerCount, 1); i++) {
+        workers.emplace_back([&]() {
+            string response;
+            for (;;) {
+                unique_lock<mutex> lock(queueMutex);
+                batchReady.wait(lock, [&]() { return stopRequested || !batches.empty(); });
+                if (batches.empty()) return;
+                RequestBatch batch = move(batches.front());
+                batches.pop_front();
+                lock.unlock();
+
+                response.clear();
+                for (const string& request : batch.requests) {
+                    executeCommand(library, *batch.session, request, response);
+                }
+                bool usable = sendAll(batch.fd, response);
+
+                lock.lock();
+                finished.emplace_back(batch.fd, usable);
+                lock.unlock();
+                char signal = 0;
+                while (write(wakeup[1], &signal, 1) < 0 && errno == EINTR) {}
+            }
+        });
+    }
+
+    thread maintenance([&library]() {
+        while (!stopRequested) {
+            for (int i = 0; i < 5 && !stopRequested; i++) this_thread::sleep_for(chrono::milliseconds(200));
+            library.checkpoint();
+        }
+    });
+
+    unordered_map<int, Client> clients;
+    auto disconnect = [&clients](int fd) {
+        close(fd);
+        clients.erase(fd);
+    };
+
+    cout << "Listening on " << socketPath << " with " << workers.size() << " workers" << endl;
+    vector<pollfd> polled;
+    vector<pair<int, bool>> returned;
+    char chunk[4096];
+    while (!stopRequested) {
+        polled.assign({{listener, POLLIN, 0}, {wakeup[0], POLLIN, 0}});
+        for (const auto& client : clients) {
+            if (!client.second.busy) polled.push_back({client.first, POLLIN, 0});
+        }
+        if (poll(polled.data(), polled.size(), 200) <= 0) continue;
+
+        if (polled[1].revents) {
+            while (read(wakeup[0], chunk, sizeof(chunk)) > 0) {}
+            {
+                lock_guard<mutex> lock(queueMutex);
+                returned.swap(finished);
+            }
+            for (const auto& connection : returned) {
+                if (connection.second) clients[connection.first].busy = false;
+                else disconnect(connection.first);
+            }
+            returned.clear();
+        }
+
+        if (polled[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) clients[fd];
+        }
+
+        for (size_t i = 2; i < polled.size(); i++) {
+            if (!polled[i].revents) continue;
+            int fd = polled[i].fd;
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (n <= 0) {
+                disconnect(fd);
+                continue;
+            }
+            Client& client = clients[fd];
+            client.pending.append(chunk, n);
+            RequestBatch batch{fd, &client.session, {}};
+            takeLines(client.pending, batch.requests);
+            if (batch.requests.empty()) continue;
+
+            client.busy = true;
+            lock_guard<mutex> lock(queueMutex);
+            batches.push_back(move(batch));
+            batchReady.notify_one();
+        }
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    batchReady.notify_all();
+    for (auto& worker : workers) worker.join();
+    maintenance.join();
+    for (const auto& client : clients) close(client.first);
+    close(wakeup[0]);
+    close(wakeup[1]);
+
+    library.saveState();
+    cout << "Server stopped" << endl;
+    return 0;
+}
+
+static int connectTo(const string& socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads until buffer holds one complete reply, then moves it into reply.
+static bool readReply(int fd, string& buffer, string& reply) {
+    for (;;) {
+        size_t eol = buffer.find('\n');
+        if (eol != string::npos) {
+            size_t lines = 0;
+            if (buffer.compare(0, 3, "OK|") == 0) lines = stoul(buffer.substr(3, eol - 3));
+            size_t end = eol;
+            for (size_t i = 0; i < lines && end != string::npos; i++) end = buffer.find('\n', end + 1);
+            if (end != string::npos) {
+                reply = buffer.substr(0, end + 1);
+                buffer.erase(0, end + 1);
+                return true;
+            }
+        }
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+}
+
+// Opens the given number of connections and sends a read-heavy mix of
+// requests on each, one at a time, timing every round trip.
+int runLoadGenerator(const string& socketPath, size_t connections, size_t requestsPerConnection) {
+    signal(SIGPIPE, SIG_IGN);
+
+    int probe = connectTo(socketPath);
+    if (probe < 0) {
+        cerr << "Error: could not connect to " << socketPath << endl;
+        return 1;
+    }
+    string buffer, reply;
+    size_t bookCount = 0;
+    if (sendAll(probe, "STATS\n") && readReply(probe, buffer, reply) && reply.compare(0, 5, "OK|1\n") == 0) {
+        bookCount = stoul(reply.substr(5));
+    }
+    close(probe);
+    if (bookCount == 0) {
+        cerr << "Error: server reported an empty catalog" << endl;
+        return 1;
+    }
+
+    static const char* const words[] = {"the", "history", "guide", "love", "war", "life", "world", "art"};
+    vector<vector<double>> latencies(connections);
+    atomic<size_t> failures{0};
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> clients;
+    for (size_t c = 0; c < connections; c++) {
+        clients.emplace_back([&, c]() {
+            int fd = connectTo(socketPath);
+            if (fd < 0) {
+                failures += requestsPerConnection;
+                return;
+            }
+            mt19937 rng(static_cast<unsigned>(c));
+            string pending, reply;
+            latencies[c].reserve(requestsPerConnection);
+            for (size_t i = 0; i < requestsPerConnection; i++) {
+                string request;
+                unsigned kind = rng() % 10;
+                if (kind < 7) request = "BOOK|" + to_string(1 + rng() % bookCount) + "\n";
+                else if (kind < 9) request = string("SEARCH|") + words[rng() % 8] + "|20\n";
+                else request = string("SUGGEST|") + words[rng() % 8][0] + "\n";
+
+                auto sentAt = chrono::steady_clock::now();
+                if (!sendAll(fd, request) || !readReply(fd, pending, reply)) {
+                    failures += requestsPerConnection - i;
+                    break;
+                }
+                latencies[c].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - sentAt).count());
+            }
+            close(fd);
+        });
+    }
+    for (auto& client : clients) client.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<double> all;
+    for (const auto& samples : latencies) all.insert(all.end(), samples.begin(), samples.end());
+    if (all.empty()) {
+        cerr << "Error: no requests completed" << endl;
+        return 1;
+    }
+    sort(all.begin(), all.end());
+    auto percentile = [&all](double p) { return all[min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+
+    cout << "Requests:   " << all.size() << " (" << failures << " failed)\n";
+    cout << "Throughput: " << static_cast<size_t>(all.size() / seconds) << " requests/sec\n";
+    cout << "Latency:    p50 " << percentile(0.50) << " us, p99 " << percentile(0.99) << " us\n";
+    return 0;
+}
+
+#else
+
+int runServer(Library&, const string&, size_t) {
+    cerr << "Error: server mode needs Unix domain sockets" << endl;
+    return 1;
+}
+
+int runLoadGenerator(const string&, size_t, size_t) {
+    cerr << "Error: server mode needs Unix domain sockets" << endl;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef LIBRARY_SERVER_H
+#define LIBRARY_SERVER_H
+
+#include <string>
+#include "LibraryManagment.h"
+
+using namespace std;
+
+// Line protocol spoken by the server: one request per line, fields separated
+// by '|'. A reply is either "ERR|reason" or "OK|n" followed by n data lines.
+//
+//   PING                          OK|0
+//   STATS                         OK|1  books|users
+//   AUTH|userID|password          OK|0  the connection now acts as userID
+//   BOOK|bookID                   OK|1  book line
+//   ISBN|isbn                     OK|1  book line
+//   SEARCH|query[|limit]          OK|n  book lines, best match first
+//   FUZZY|query[|limit]           OK|n  book lines
+//   SUGGEST|prefix[|limit]        OK|n  completions, most books first
+//   BORROW|userID|bookID          OK|0
+//   RETURN|userID|bookID          OK|0
+//   RESERVE|userID|bookID         OK|0
+//   CANCEL|userID|bookID          OK|0
+//   RESERVED|userID               OK|n  book lines
+//   LOAN|bookID                   OK|1  userID|borrowDate|dueDate
+//   FINE|userID                   OK|1  amount
+//   PAY|userID|amount             OK|0
+//
+// Book lines use the books.txt layout and dates are Unix timestamps. The
+// commands from BORROW to PAY act on the given user's account and are refused
+// with ERR|not authenticated unless the connection's last successful AUTH was
+// for that user. Batch mode reads the same requests from a file or stdin,
+// needs no AUTH and also accepts them with whitespace-separated fields
+// ("BORROW 101 4").
+const string DEFAULT_SOCKET_PATH = "data/library.sock";
+
+// Who the requests of one connection act for. Batch mode is trusted, since
+// its input comes from the operator rather than from a client.
+struct Session {
+    bool trusted = false;
+    int userID = -1;
+};
+
+void executeCommand(Library& library, Session& session, const string& request, string& response);
+
+int runServer(Library& library, const string& socketPath, size_t workerCount);
+int runLoadGenerator(const string& socketPath, size_t connections, size_t requestsPerConnection);
+int runBatch(Library& library, const string& path, size_t checkpointInterval);
+int runImport(Library& library, const string& path, char delimiter);
+
+#endif
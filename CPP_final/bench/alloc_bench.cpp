@@ -0,0 +1,66 @@
+// Heap traffic and time of loading and reloading the catalog, with the
+// EntityPool counters for the books, members, accounts and loan arrays it
+// serves.
+//
+//   alloc_bench [books] [users] [rounds]  default 200000 books, 20000 users, 3 rounds
+//
+// Every user gets a couple of loans, so the account files and their
+// BorrowLists are part of each load.
+#include "bench_common.h"
+
+#include <atomic>
+#include <new>
+
+static atomic<size_t> heapAllocations{0};
+
+void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void* ptr = malloc(size ? size : 1)) return ptr;
+    throw bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+static void printPool(const char* label) {
+    PoolStats pool = EntityPool::stats();
+    cout << label << "pool: " << pool.allocations << " allocations, " << pool.reused << " reused, " << pool.live
+         << " live, " << pool.blocks << " blocks (" << pool.bytes / (1 << 20) << " MiB)\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t bookCount = argOr(argc, argv, 1, 200000);
+    size_t userCount = argOr(argc, argv, 2, 20000);
+    size_t rounds = argOr(argc, argv, 3, 3);
+    ScratchDirectory scratch;
+
+    {
+        Library library;
+        fillCatalog(library, bookCount);
+        fillUsers(library, userCount);
+        for (size_t i = 0; i < userCount; i++) {
+            int userID = 100000 + static_cast<int>(i);
+            library.borrowBook(userID, static_cast<int>(1 + (2 * i) % bookCount));
+            library.borrowBook(userID, static_cast<int>(2 + (2 * i) % bookCount));
+        }
+        library.saveState();
+    }
+    printPool("After generating:  ");
+
+    // Text files rather than the snapshot, so that every account file is read.
+    for (size_t round = 0; round < rounds; round++) {
+        size_t before = heapAllocations;
+        auto start = chrono::steady_clock::now();
+        {
+            Library library;
+            library.loadTextFiles();
+            if (library.getBookCount() != bookCount) cerr << "Error: loaded " << library.getBookCount() << " books" << endl;
+        }
+        double seconds = secondsSince(start);
+        cout << "Load " << round + 1 << ": " << seconds << " s, " << heapAllocations - before
+             << " heap allocations (" << static_cast<double>(heapAllocations - before) / (bookCount + userCount)
+             << " per book or user)\n";
+        printPool("        ");
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef LIBRARY_BENCH_COMMON_H
+#define LIBRARY_BENCH_COMMON_H
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include "../LibraryManagment.h"
+
+using namespace std;
+
+// Helpers shared by the benchmarks: a scratch data directory, a synthetic
+// catalog with realistic repetition of authors and publishers, and timing.
+
+// Moves into a fresh temporary directory with an empty data/ tree, since the
+// library reads and writes paths relative to the working directory. The
+// directory is removed again when the returned guard goes out of scope.
+class ScratchDirectory {
+public:
+    ScratchDirectory() {
+        char pattern[] = "/tmp/library-bench-XXXXXX";
+        if (!mkdtemp(pattern)) {
+            cerr << "Error: could not create a scratch directory" << endl;
+            exit(1);
+        }
+        path = pattern;
+        previous = filesystem::current_path();
+        filesystem::current_path(path);
+        filesystem::create_directories("data/users");
+        filesystem::create_directories("data/accounts");
+    }
+    ~ScratchDirectory() {
+        filesystem::current_path(previous);
+        error_code error;
+        filesystem::remove_all(path, error);
+    }
+    ScratchDirectory(const ScratchDirectory&) = delete;
+    ScratchDirectory& operator=(const ScratchDirectory&) = delete;
+
+private:
+    filesystem::path path;
+    filesystem::path previous;
+};
+
+static const char* const TITLE_WORDS[] = {
+    "the", "of", "and", "palace", "illusion", "guide", "malgudi", "days", "river", "night",
+    "tiger", "white", "god", "small", "things", "suitable", "boy", "train", "loss", "inheritance",
+    "children", "midnight", "garden", "house", "shadow", "lines", "sea", "ibis", "poppies", "history"};
+
+// Book with the given id, drawn from 3000 authors and 500 publishers; the same seed
+// always gives the same book.
+inline unique_ptr<Book> makeBook(int id, mt19937& rng) {
+    string title;
+    for (int words = 2 + rng() % 4; words > 0; words--) {
+        string word = TITLE_WORDS[rng() % (sizeof(TITLE_WORDS) / sizeof(TITLE_WORDS[0]))];
+        word[0] = static_cast<char>(toupper(word[0]));
+        title += word + " ";
+    }
+    title += to_string(id);
+    int author = rng() % 3000;
+    string authorName = "Author" + to_string(author) + " Name" + to_string(author % 97);
+    string publisher = "Publisher " + to_string(rng() % 500);
+    char isbn[32];
+    snprintf(isbn, sizeof(isbn), "978-%010d", id);
+    return make_unique<Book>(id, title, authorName, publisher, 1900 + rng() % 125, isbn);
+}
+
+// Adds books 1..count in one batch per 10000, like an import.
+inline void fillCatalog(Library& library, size_t count, unsigned seed = 1) {
+    mt19937 rng(seed);
+    vector<unique_ptr<Book>> batch;
+    for (size_t id = 1; id <= count; id++) {
+        batch.push_back(makeBook(static_cast<int>(id), rng));
+        if (batch.size() == 10000 || id == count) {
+            library.addBooks(batch);
+            batch.clear();
+        }
+    }
+}
+
+// Students 100000 onwards, one per department in turn.
+inline void fillUsers(Library& library, size_t count) {
+    static const char* const departments[] = {"Physics", "Computer Science", "Mathematics", "Chemistry", "History"};
+    for (size_t i = 0; i < count; i++) {
+        int id = 100000 + static_cast<int>(i);
+        auto user = make_unique<Student>(id, "User " + to_string(id), "pw" + to_string(id));
+        user->setDepartment(departments[i % 5]);
+        library.addUser(move(user));
+    }
+}
+
+inline double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+inline size_t argOr(int argc, char* argv[], int index, size_t fallback) {
+    return argc > index ? strtoul(argv[index], nullptr, 10) : fallback;
+}
+
+#endif
@@ -0,0 +1,98 @@
+// Contended checkout: many threads racing to claim the same few books.
+//
+//   checkout_bench [hot books] [seconds]  default 4 books, 1 s per step
+//
+// Compares Book::tryCheckout() (one compare-and-swap on the status word)
+// against the same claim made under a per-book mutex, as borrowBook did
+// before. Every successful claim is checked back in straight away, so the
+// books keep changing hands. A last run goes through Library::borrowBook()
+// and returnBook() on the same hot books.
+#include "bench_common.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// The circulation state as it was kept before: plain fields behind a lock.
+struct LockedBook {
+    mutex lock;
+    BookState state = BookState::Available;
+    int holder = -1;
+
+    bool tryCheckout(int userID) {
+        lock_guard<mutex> guard(lock);
+        if (state == BookState::Loaned || (state == BookState::Held && holder != userID)) return false;
+        state = BookState::Loaned;
+        holder = userID;
+        return true;
+    }
+
+    void checkIn() {
+        lock_guard<mutex> guard(lock);
+        state = BookState::Available;
+        holder = -1;
+    }
+};
+
+// Runs claim(thread, round) on threadCount threads for the given time and
+// returns successful claims per second.
+template<typename Claim>
+static double claimsPerSecond(int threadCount, size_t seconds, Claim claim) {
+    atomic<bool> stop{false};
+    atomic<long> claims{0};
+    vector<thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            long won = 0;
+            for (unsigned round = 0; !stop; round++) won += claim(t, round);
+            claims += won;
+        });
+    }
+    auto start = chrono::steady_clock::now();
+    this_thread::sleep_for(chrono::seconds(seconds));
+    stop = true;
+    for (auto& worker : threads) worker.join();
+    return claims / secondsSince(start);
+}
+
+int main(int argc, char* argv[]) {
+    size_t hotBooks = argOr(argc, argv, 1, 4);
+    size_t seconds = argOr(argc, argv, 2, 1);
+    ScratchDirectory scratch;
+
+    vector<unique_ptr<Book>> books;
+    vector<unique_ptr<LockedBook>> lockedBooks;
+    for (size_t i = 0; i < hotBooks; i++) {
+        books.push_back(make_unique<Book>(static_cast<int>(i + 1), "Hot", "Author", "Publisher", 2000, ""));
+        lockedBooks.push_back(make_unique<LockedBook>());
+    }
+
+    Library library;
+    fillCatalog(library, hotBooks);
+    fillUsers(library, 64);
+
+    cout << "threads\tCAS claims/s\tmutex claims/s\tborrowBook claims/s\n";
+    for (int threadCount = 1; threadCount <= 16; threadCount *= 2) {
+        double cas = claimsPerSecond(threadCount, seconds, [&](int t, unsigned round) {
+            Book& book = *books[(t + round) % hotBooks];
+            if (!book.tryCheckout(t)) return 0;
+            book.checkIn(-1);
+            return 1;
+        });
+        double locked = claimsPerSecond(threadCount, seconds, [&](int t, unsigned round) {
+            LockedBook& book = *lockedBooks[(t + round) % hotBooks];
+            if (!book.tryCheckout(t)) return 0;
+            book.checkIn();
+            return 1;
+        });
+        double borrowed = claimsPerSecond(threadCount, seconds, [&](int t, unsigned round) {
+            int bookID = static_cast<int>(1 + (t + round) % hotBooks);
+            if (!library.borrowBook(100000 + t, bookID)) return 0;
+            library.returnBook(100000 + t, bookID);
+            return 1;
+        });
+        cout << threadCount << "\t" << static_cast<long>(cas) << "\t" << static_cast<long>(locked) << "\t"
+             << static_cast<long>(borrowed) << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+// Cold start from the binary snapshot against the text loader.
+//
+//   cold_start_bench [books] [users]      default 1000000 books, 10000 users
+//
+// Writes a synthetic catalog with saveState(), then times loading it back
+// into a fresh Library each way.
+#include "bench_common.h"
+
+int main(int argc, char* argv[]) {
+    size_t bookCount = argOr(argc, argv, 1, 1000000);
+    size_t userCount = argOr(argc, argv, 2, 10000);
+    ScratchDirectory scratch;
+
+    {
+        Library library;
+        fillCatalog(library, bookCount);
+        fillUsers(library, userCount);
+        auto start = chrono::steady_clock::now();
+        library.saveState();
+        cout << "Save:           " << secondsSince(start) << " s\n";
+    }
+    cout << "books.txt:      " << filesystem::file_size("data/books.txt") / (1 << 20) << " MiB\n";
+    cout << "library.snap:   " << filesystem::file_size("data/library.snap") / (1 << 20) << " MiB\n";
+
+    for (int round = 0; round < 2; round++) {
+        double textSeconds, snapshotSeconds;
+        {
+            Library library;
+            auto start = chrono::steady_clock::now();
+            library.loadTextFiles();
+            textSeconds = secondsSince(start);
+            if (library.getBookCount() != bookCount) cerr << "Error: text load found " << library.getBookCount() << " books" << endl;
+        }
+        {
+            Library library;
+            auto start = chrono::steady_clock::now();
+            if (!library.loadSnapshot("data/library.snap")) cerr << "Error: snapshot rejected" << endl;
+            snapshotSeconds = secondsSince(start);
+            if (library.getBookCount() != bookCount) cerr << "Error: snapshot load found " << library.getBookCount() << " books" << endl;
+        }
+        cout << "Round " << round + 1 << ":        text " << textSeconds << " s, snapshot " << snapshotSeconds
+             << " s (" << textSeconds / snapshotSeconds << "x)\n";
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Memory per book of a loaded catalog, and what interning saves on the author
+// and publisher fields.
+//
+//   memory_bench [books...]               default 100000 and 1000000 books
+//
+// Heap usage comes from glibc's mallinfo2(), so it covers the books, their
+// strings, the table and every search index. The string pool is reported
+// separately through StringPool::size() and bytes().
+#include "bench_common.h"
+
+#include <malloc.h>
+
+static size_t heapInUse() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// What a std::string member costs: the object itself, plus a heap block when
+// the text is too long for the small-string buffer.
+static size_t inlineStringBytes(string_view text) {
+    size_t bytes = sizeof(string);
+    if (text.size() >= sizeof(string) / 2) bytes += (text.size() + 1 + 15) / 16 * 16;
+    return bytes;
+}
+
+static void measure(size_t bookCount) {
+    ScratchDirectory scratch;
+    size_t heapBefore = heapInUse();
+    Library library;
+    fillCatalog(library, bookCount);
+    size_t heapBytes = heapInUse() - heapBefore;
+    // The pool is process-wide, so a later run finds its strings already there.
+    size_t poolBytes = StringPool::instance().bytes();
+
+    size_t inlineBytes = 0;
+    for (size_t id = 1; id <= bookCount; id++) {
+        const Book* book = library.getBook(static_cast<int>(id));
+        inlineBytes += inlineStringBytes(book->getAuthor()) + inlineStringBytes(book->getPublisher());
+    }
+    size_t internedBytes = 2 * sizeof(InternedString) * bookCount + poolBytes;
+
+    cout << bookCount << " books:\n"
+         << "  heap in use:        " << heapBytes / (1 << 20) << " MiB, " << heapBytes / bookCount << " bytes per book\n"
+         << "  string pool:        " << StringPool::instance().size() << " strings, " << poolBytes / 1024 << " KiB\n"
+         << "  author + publisher: " << internedBytes / bookCount << " bytes per book interned, "
+         << inlineBytes / bookCount << " as std::string\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) measure(argOr(argc, argv, i, 0));
+    } else {
+        measure(100000);
+        measure(1000000);
+    }
+    return 0;
+}
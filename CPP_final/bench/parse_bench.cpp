@@ -0,0 +1,67 @@
+// Record parsing throughput: splitting books.txt lines into fields and
+// converting the numeric ones.
+//
+//   parse_bench [books] [rounds]          default 200000 books, 5 rounds
+//
+// Compares RecordFields (string_view fields, from_chars) with the
+// istringstream split and stoi it replaced, on the same generated file.
+#include "bench_common.h"
+
+#include <sstream>
+
+// The tokenizer the loaders used before RecordFields.
+static vector<string> splitWithStream(const string& str, char delim) {
+    vector<string> tokens;
+    string token;
+    istringstream tokenStream(str);
+    while (getline(tokenStream, token, delim)) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+// Calls parseLine on every line of content; returns MB/s and adds the parsed
+// numbers to checksum, so the work can't be optimized away.
+template<typename ParseLine>
+static double megabytesPerSecond(const string& content, long& checksum, ParseLine parseLine) {
+    auto start = chrono::steady_clock::now();
+    for (size_t pos = 0; pos < content.size();) {
+        size_t eol = content.find('\n', pos);
+        if (eol == string::npos) eol = content.size();
+        checksum += parseLine(string_view(content.data() + pos, eol - pos));
+        pos = eol + 1;
+    }
+    return content.size() / secondsSince(start) / (1 << 20);
+}
+
+int main(int argc, char* argv[]) {
+    size_t bookCount = argOr(argc, argv, 1, 200000);
+    size_t rounds = argOr(argc, argv, 2, 5);
+
+    mt19937 rng(1);
+    string content;
+    for (size_t id = 1; id <= bookCount; id++) {
+        auto book = makeBook(static_cast<int>(id), rng);
+        content += to_string(book->getBookID()) + "|" + book->getTitle() + "|" + string(book->getAuthor()) + "|" +
+                   string(book->getPublisher()) + "|" + to_string(book->getYear()) + "|" + book->getISBN() + "|1\n";
+    }
+    cout << "books.txt: " << content.size() / (1 << 20) << " MiB, " << bookCount << " lines\n";
+
+    long checksum = 0;
+    for (size_t round = 0; round < rounds; round++) {
+        double before = megabytesPerSecond(content, checksum, [](string_view line) {
+            auto parts = splitWithStream(string(line), '|');
+            return stoi(parts[0]) + stoi(parts[4]);
+        });
+        double after = megabytesPerSecond(content, checksum, [](string_view line) {
+            RecordFields parts(line, '|');
+            int bookID = 0, year = 0;
+            parts.tryNumber(0, bookID);
+            parts.tryNumber(4, year);
+            return bookID + year;
+        });
+        cout << "Round " << round + 1 << ": istringstream+stoi " << before << " MB/s, RecordFields " << after
+             << " MB/s (" << after / before << "x)\n";
+    }
+    return checksum == 0;
+}
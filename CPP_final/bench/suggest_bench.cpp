@@ -0,0 +1,52 @@
+// Type-ahead latency: every keystroke of a title or author being typed is one
+// suggest() call, as the menu and the SUGGEST server command make them.
+//
+//   suggest_bench [books...]              default 100000 and 1000000 books
+//
+// For each catalog size, types 500 titles and 500 authors taken from the
+// catalog one character at a time and reports the per-keystroke latency.
+#include "bench_common.h"
+
+#include <algorithm>
+
+static void typeAhead(size_t bookCount) {
+    ScratchDirectory scratch;
+    Library library;
+    fillCatalog(library, bookCount);
+
+    mt19937 rng(7);
+    vector<string> texts;
+    for (int i = 0; i < 500; i++) {
+        const Book* book = library.getBook(1 + rng() % bookCount);
+        texts.emplace_back(book->getTitle());
+        texts.emplace_back(book->getAuthor());
+    }
+
+    vector<double> micros;
+    size_t suggestions = 0;
+    for (const string& text : texts) {
+        for (size_t typed = 1; typed <= text.size(); typed++) {
+            string prefix = text.substr(0, typed);
+            auto start = chrono::steady_clock::now();
+            suggestions += library.suggest(prefix).size();
+            micros.push_back(secondsSince(start) * 1e6);
+        }
+    }
+
+    sort(micros.begin(), micros.end());
+    double total = 0;
+    for (double micro : micros) total += micro;
+    cout << bookCount << " books, " << micros.size() << " keystrokes (" << suggestions << " suggestions)\n"
+         << "  mean " << total / micros.size() << " us, p50 " << micros[micros.size() / 2] << " us, p99 "
+         << micros[micros.size() * 99 / 100] << " us, max " << micros.back() << " us\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) typeAhead(argOr(argc, argv, i, 0));
+    } else {
+        typeAhead(100000);
+        typeAhead(1000000);
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+// Catalog storage: full scans and lookups by ID on BookTable, against the
+// unordered_map of unique_ptr<Book> it replaced.
+//
+//   table_bench [books] [rounds]          default 1000000 books, 5 rounds
+//
+// Both hold the same generated books. A scan sums the publication years of
+// every book; lookups fetch random IDs, a tenth of them missing.
+#include "bench_common.h"
+
+#include <unordered_map>
+
+int main(int argc, char* argv[]) {
+    size_t bookCount = argOr(argc, argv, 1, 1000000);
+    size_t rounds = argOr(argc, argv, 2, 5);
+
+    BookTable table;
+    unordered_map<int, unique_ptr<Book>> map;
+    table.reserve(bookCount);
+    map.reserve(bookCount);
+    // Same seed for both, so they get identical books.
+    mt19937 rng(1), mapRng(1);
+    for (size_t id = 1; id <= bookCount; id++) {
+        table.insert(makeBook(static_cast<int>(id), rng));
+        map.emplace(static_cast<int>(id), makeBook(static_cast<int>(id), mapRng));
+    }
+
+    vector<int> lookups(bookCount);
+    uniform_int_distribution<int> pick(1, static_cast<int>(bookCount + bookCount / 9));
+    for (int& id : lookups) id = pick(rng);
+
+    long checksum = 0;
+    cout << "books\tscan ms (table / map)\tlookups per us (table / map)\n";
+    for (size_t round = 0; round < rounds; round++) {
+        auto start = chrono::steady_clock::now();
+        for (const Book& book : table) checksum += book.getYear();
+        double tableScan = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        for (const auto& pair : map) checksum += pair.second->getYear();
+        double mapScan = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        for (int id : lookups) {
+            if (const Book* book = table.find(id)) checksum += book->getYear();
+        }
+        double tableLookup = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        for (int id : lookups) {
+            auto it = map.find(id);
+            if (it != map.end()) checksum += it->second->getYear();
+        }
+        double mapLookup = secondsSince(start);
+
+        cout << bookCount << "\t" << tableScan * 1e3 << " / " << mapScan * 1e3 << "\t"
+             << lookups.size() / tableLookup / 1e6 << " / " << lookups.size() / mapLookup / 1e6 << "\n";
+    }
+    return checksum == 0;
+}
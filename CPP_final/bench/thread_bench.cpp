@@ -0,0 +1,64 @@
+// Throughput of a shared Library from 1 to 32 threads.
+//
+//   thread_bench [books] [seconds]        default 100000 books, 2 s per step
+//
+// Each thread runs a kiosk-like mix: 70% lookups (by ID, ISBN and type-ahead
+// prefix), 15% borrows and 15% returns, on random books and users.
+#include "bench_common.h"
+
+#include <atomic>
+#include <thread>
+
+int main(int argc, char* argv[]) {
+    size_t bookCount = argOr(argc, argv, 1, 100000);
+    size_t seconds = argOr(argc, argv, 2, 2);
+    const int userCount = 10000;
+    ScratchDirectory scratch;
+
+    Library library;
+    fillCatalog(library, bookCount);
+    fillUsers(library, userCount);
+
+    double singleThreaded = 0;
+    for (int threadCount = 1; threadCount <= 32; threadCount *= 2) {
+        atomic<bool> stop{false};
+        atomic<long> operations{0};
+        vector<thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([&, t] {
+                mt19937 rng(static_cast<unsigned>(threadCount * 100 + t));
+                char isbn[32];
+                long done = 0;
+                while (!stop) {
+                    int bookID = 1 + rng() % bookCount;
+                    int userID = 100000 + rng() % userCount;
+                    unsigned choice = rng() % 100;
+                    if (choice < 30) {
+                        library.getBook(bookID);
+                    } else if (choice < 50) {
+                        snprintf(isbn, sizeof(isbn), "978%010d", bookID);
+                        library.findBookByISBN(isbn);
+                    } else if (choice < 70) {
+                        library.suggest(TITLE_WORDS[rng() % 10]);
+                    } else if (choice < 85) {
+                        library.borrowBook(userID, bookID);
+                    } else if (auto loan = library.findLoan(bookID)) {
+                        library.returnBook(loan->userID, bookID);
+                    }
+                    done++;
+                }
+                operations += done;
+            });
+        }
+        auto start = chrono::steady_clock::now();
+        this_thread::sleep_for(chrono::seconds(seconds));
+        stop = true;
+        for (auto& worker : threads) worker.join();
+        double perSecond = operations / secondsSince(start);
+        if (threadCount == 1) singleThreaded = perSecond;
+        cout << threadCount << " threads:\t" << static_cast<long>(perSecond) << " ops/s ("
+             << perSecond / singleThreaded << "x)\n";
+    }
+    cout << "hardware threads: " << thread::hardware_concurrency() << "\n";
+    return 0;
+}
@@ -6,37 +6,12 @@
 #include <iomanip>
 #include <fstream> // To read and write from files
 #include <sstream>
-#include <functional>
+#include <cstdio>
 #include "LibraryManagment.h"
+#include "LibraryServer.h"
 
 using namespace std;
 
-vector<string> split(const string& str, char delim) {
-    string token;
-    vector<string> token_array;
-    istringstream tokenStream(str); 
-    while (getline(tokenStream, token, delim)) {
-        token_array.push_back(token);
-    }
-    return token_array;
-}
-
-void readDataFile(const string& filename, function<void(const vector<string>&)> func) { // func function processes each line of the file after splitting it into parts
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cout << "\033[1;31mError: Could not open the file " << filename << "\033[0m" << endl;
-        return;
-    }
-
-    string line;
-    while (getline(file, line)) {
-        if (line.empty() || line[0] == '#') continue; // Empty lines and comments
-        
-        auto parts = split(line, '|');
-        func(parts);
-    }
-}
-
 void displayMenu();
 void displayUserMenu(const Member* member);
 void handleAddUser(Library& library);
@@ -57,6 +32,7 @@ void handleReserveBook(Library& library, int userID);
 void handleCancelReservation(Library& library, int userID);
 void handleViewReservations(const Library& library, int userID);
 void handleViewAllBorrowedBooks(const Library& library);
+void handleViewOverdueBooks(Library& library);
 void initializeLibrary(Library& lib);
 
 
@@ -120,6 +96,7 @@ void displayUserMenu(const Member* member) {
         cout << "14. Remove User\n";
         cout << "15. Check User\n";
         cout << "16. View All Borrowed Books\n";
+        cout << "17. View Overdue Books\n";
     }
     
     cout << "\n0. Logout\n";
@@ -144,21 +121,8 @@ void handleReturnBook(Library& library, int userID) {
         return;
     }
 
-    Account* account = library.getAccount(userID);
-    if (!account) {
-        cout << "\033[1;31mError: Account not found.\033[0m\n";
-        return;
-    }
-
-    bool hasBorrowed = false;
-    for (const auto& borrow : account->getCurrentBorrows()) {
-        if (borrow.bookID == bookID) {
-            hasBorrowed = true;
-            break;
-        }
-    }
-
-    if (!hasBorrowed) {
+    auto loan = library.findLoan(bookID);
+    if (!loan || loan->userID != userID) {
         cout << "\033[1;31mError: You have not borrowed this book.\033[0m"<<endl;
         return;
     }
@@ -221,13 +185,37 @@ void displayBookDetails(const Book* book) {
     cout << "-------------------------------------\n";
 }
 
+void readYearBound(const string& prompt, int& year) {
+    string line;
+    int value;
+    cout << prompt;
+    getline(cin, line);
+    if (istringstream(line) >> value) year = value; // Blank or invalid input leaves the bound open
+}
+
+vector<const Book*> searchByField(const Library& library) {
+    BookQuery query;
+    cout << "Leave a field blank to skip it.\n";
+    cout << "Title: "; getline(cin, query.title);
+    cout << "Author: "; getline(cin, query.author);
+    cout << "Publisher: "; getline(cin, query.publisher);
+    cout << "ISBN: "; getline(cin, query.isbn);
+    readYearBound("Published from year: ", query.minYear);
+    readYearBound("Published up to year: ", query.maxYear);
+    return library.findBooks(query);
+}
+
 void handleSearchBooks(const Library& library) {
     clearInputBuffer();
     string query;
-    cout << "Enter search term (title/author): ";
+    cout << "Enter search term (title/author), or press Enter to search by field: ";
     getline(cin, query);
 
-    auto results = library.searchBooks(query);
+    auto results = query.empty() ? searchByField(library) : library.searchBooks(query);
+    if (results.empty() && !query.empty()) {
+        results = library.searchBooksFuzzy(query);
+        if (!results.empty()) cout << "No exact matches, showing close matches.\n";
+    }
     if (results.empty()) {
         cout << "No books found.\n";
         return;
@@ -365,7 +353,7 @@ void handleAddUser(Library& library) {
     char userType;
 
     cout << "\nAdd New User\n";
-    cout << "User Type (Student/Professor/Librarian): ";
+    cout << "User Type (Student/Professor/Librarian/Visiting scholar): ";
     cin >> userType;
     cin.ignore();
 
@@ -393,6 +381,9 @@ void handleAddUser(Library& library) {
         case 'L':
             user = make_unique<Librarian>(userID, name, password);
             break;
+        case 'V':
+            user = make_unique<Member>(userID, name, password, Role::VisitingScholar);
+            break;
         default:
             cout << "Invalid user type!\n";
             return;
@@ -435,21 +426,59 @@ void handleCheckUser(const Library& library) {
     }
 }
 
+// Formats a page of books as one table, so it reaches the terminal in a
+// single write rather than a dozen stream insertions per book.
+void renderBookPage(const vector<const Book*>& books, string& out) {
+    out += "-------------------------------------\n";
+    out += "ID  |  Title  |  Author  |  Publisher  |  Year  |  ISBN  |  Status\n";
+    out += "-------------------------------------\n";
+    for (const Book* book : books) {
+        out += to_string(book->getBookID());
+        out += "  |  ";
+        out += book->getTitle();
+        out += "  |  ";
+        out += book->getAuthor();
+        out += "  |  ";
+        out += book->getPublisher();
+        out += "  |  ";
+        out += to_string(book->getYear());
+        out += "  |  ";
+        out += book->getISBN();
+        out += book->isAvailable() ? "  |  Available\n" : "  |  Borrowed\n";
+    }
+    out += "-------------------------------------\n";
+}
+
+// Pauses after the last page itself, since the pager has already consumed the
+// rest of the menu line that waitForEnter() would skip.
 void handleViewAllBooks(const Library& library) {
+    const size_t pageSize = 20;
     cout << "\n--- All Books in Library ---\n";
-    
-    auto books = library.searchBooks("");
-    if (books.empty()) {
+
+    clearInputBuffer();
+    string out, answer;
+    size_t total = library.getBookCount();
+    if (total == 0) {
         cout << "No books in the library.\n";
+        cout << "\nPress Enter to continue...";
+        getline(cin, answer);
         return;
     }
+    cout << "\nTotal Books: " << total << "\n";
 
-    cout << "\nTotal Books: " << books.size() << "\n";
-    cout << "--------------------\n";
-    
-    for (const auto* book : books) {
-        displayBookDetails(book);
-        cout << "--------------------\n";
+    optional<int> cursor = numeric_limits<int>::min();
+    for (size_t pageNumber = 1; cursor; pageNumber++) {
+        BookPage page = library.listBooks(*cursor, pageSize);
+        cursor = page.next;
+
+        out.clear();
+        out += "\nPage " + to_string(pageNumber) + " of " + to_string((total + pageSize - 1) / pageSize) + "\n";
+        renderBookPage(page.books, out);
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+
+        cout << (cursor ? "Press Enter for the next page, or q to stop: " : "\nPress Enter to continue...");
+        if (!getline(cin, answer) || answer == "q" || answer == "Q") break;
     }
 }
 
@@ -521,82 +550,100 @@ void handleViewReservations(const Library& library, int userID) {
 }
 
 void handleViewAllBorrowedBooks(const Library& library) {
-    auto borrowedBooks = library.getAllBorrowedBooks();
-    if (borrowedBooks.empty()) {
-        cout << "No books are currently borrowed.\n";
-        return;
-    }
-
-    cout << "\n--- Currently Borrowed Books ---\n\n";
-    for (const auto& info : borrowedBooks) {
+    bool anyBorrowed = false;
+    library.forEachLoan([&anyBorrowed](const Book& book, const Member& borrower, const LoanSummary& loan) {
+        if (!anyBorrowed) {
+            cout << "\n--- Currently Borrowed Books ---\n\n";
+            anyBorrowed = true;
+        }
         cout << "Book Details:\n";
         cout << "-------------\n";
-        displayBookDetails(info.book);
+        displayBookDetails(&book);
         cout << "\nBorrower Details:\n";
         cout << "----------------\n";
-        cout << "ID: " << info.borrower->getUserID() << "\n";
-        cout << "Name: " << info.borrower->getName() << "\n";
-        cout << "Role: " << info.borrower->getRole() << "\n";
-        cout << "Department: " << info.borrower->getDepartment() << "\n";
+        cout << "ID: " << borrower.getUserID() << "\n";
+        cout << "Name: " << borrower.getName() << "\n";
+        cout << "Role: " << borrower.getRole() << "\n";
+        cout << "Department: " << borrower.getDepartment() << "\n";
         
         // Converting time_points to a readable format
-        auto borrowTime = chrono::system_clock::to_time_t(info.borrowDate);
-        auto dueTime = chrono::system_clock::to_time_t(info.dueDate);
+        auto borrowTime = chrono::system_clock::to_time_t(loan.borrowDate);
+        auto dueTime = chrono::system_clock::to_time_t(loan.dueDate);
         
         cout << "\nBorrow Date: " << ctime(&borrowTime);
         cout << "Due Date: " << ctime(&dueTime);
         cout << "============================\n\n";
+    });
+
+    if (!anyBorrowed) {
+        cout << "No books are currently borrowed.\n";
     }
 }
 
-void initializeLibrary(Library& lib) {
-    readDataFile("data/books.txt", [&lib](const auto& parts) {
-        if (parts.size() == 7) {  // Changed from 6 to 7 to match the save format
-            int id = stoi(parts[0]);
-            int year = stoi(parts[4]);
-            bool available = parts[6] == "1";
-            auto book = make_unique<Book>(
-                id, parts[1], parts[2], parts[3], year, parts[5]
-            );
-            book->setAvailable(available);
-            lib.addBook(move(book));
-        }
-    });
+void handleViewOverdueBooks(Library& library) {
+    auto now = chrono::system_clock::now();
+    library.tickOverdue(now);
 
-    readDataFile("data/users/students.txt", [&lib](const auto& parts) {
-        if (parts.size() == 4) {
-            int id = stoi(parts[0]);
-            auto student = make_unique<Student>(id, parts[1], parts[2]);
-            student->setDepartment(parts[3]);
-            lib.addUser(move(student));
-            lib.loadAccountInfo(id);
-        }
-    });
+    // Fines are printed with two decimals; cout's format is put back after.
+    ios::fmtflags savedFlags = cout.flags();
+    streamsize savedPrecision = cout.precision();
 
-    readDataFile("data/users/professors.txt", [&lib](const auto& parts) {
-        if (parts.size() == 4) {
-            int id = std::stoi(parts[0]);
-            auto faculty = std::make_unique<Professor>(id, parts[1], parts[2]);
-            faculty->setDepartment(parts[3]);
-            lib.addUser(std::move(faculty));
-            lib.loadAccountInfo(id);
+    auto overdue = library.getOverdueLoans(now);
+    if (overdue.empty()) {
+        cout << "No books are overdue.\n";
+    } else {
+        cout << "\n--- Overdue Books ---\n\n";
+        for (const auto& info : overdue) {
+            auto dueTime = chrono::system_clock::to_time_t(info.dueDate);
+            auto overdueHours = chrono::duration_cast<chrono::hours>(now - info.dueDate).count();
+            cout << info.book->getBookID() << "  |  " << info.book->getTitle() << "  |  "
+                 << info.borrower->getUserID() << "  |  " << info.borrower->getName() << "\n";
+            cout << "Due Date: " << ctime(&dueTime);
+            cout << "Fine so far: Rs. " << fixed << setprecision(2)
+                 << overdueHours * info.borrower->getFineRate() << "\n\n";
         }
-    });
+    }
 
-    readDataFile("data/users/librarians.txt", [&lib](const auto& parts) {
-        if (parts.size() == 4) {
-            int id = std::stoi(parts[0]);
-            auto librarian = std::make_unique<Librarian>(id, parts[1], parts[2]);
-            librarian->setDepartment(parts[3]);
-            lib.addUser(std::move(librarian));
-            lib.loadAccountInfo(id);
-        }
-    });
+    cout << "Due in the next 7 days: " << library.getLoansDueWithin(7, now).size() << "\n";
+    cout << "Total accrued fines: Rs. " << fixed << setprecision(2)
+         << library.getAccruedLiability(now) << "\n";
+    cout.flags(savedFlags);
+    cout.precision(savedPrecision);
+}
+
+void initializeLibrary(Library& lib) {
+    // The binary snapshot holds everything the text files do and needs no
+    // parsing; the text files are only read when it is missing or damaged.
+    if (!lib.loadSnapshot("data/library.snap")) {
+        lib.loadTextFiles();
+    }
+
+    lib.replayJournal(); // Re-apply operations made since the last saveState()
 }
 
-int main() {
+// main                                      interactive menu
+// main --serve [socket] [workers]           serve the line protocol
+// main --loadgen [socket] [connections] [requests]
+// main --batch file|- [checkpoint interval]
+// main --import file [delimiter]
+int main(int argc, char* argv[]) {
+    string mode = argc > 1 ? argv[1] : "";
+    string socketPath = argc > 2 ? argv[2] : DEFAULT_SOCKET_PATH;
+    if (mode == "--loadgen") {
+        return runLoadGenerator(socketPath, argc > 3 ? stoul(argv[3]) : 8, argc > 4 ? stoul(argv[4]) : 10000);
+    }
+
     Library library;
     initializeLibrary(library);
+    if (mode == "--serve") {
+        return runServer(library, socketPath, argc > 3 ? stoul(argv[3]) : 8);
+    }
+    if (mode == "--batch") {
+        return runBatch(library, argc > 2 ? argv[2] : "-", argc > 3 ? max(stoul(argv[3]), 1UL) : 100000);
+    }
+    if (mode == "--import" && argc > 2) {
+        return runImport(library, argv[2], argc > 3 && argv[3][0] ? argv[3][0] : '|');
+    }
 
     while (true) {
         displayMenu();
@@ -627,7 +674,8 @@ int main() {
                         cin >> userChoice;
 
                         if (userChoice == 0) {
-                            library.saveState();
+                            library.checkpoint();
+                            library.sync();
                             cout << "Logging out...\n";
                             waitForEnter();
                             break;
@@ -640,33 +688,32 @@ int main() {
                                 break;
                             case 2:
                                 handleViewAllBooks(library);
-                                waitForEnter();
                                 break;
                             case 3:
                                 if (member->canBorrow()) {
                                     handleBorrowBook(library, userID);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
                             case 4:
                                 if (member->canBorrow()) {
                                     handleReturnBook(library, userID);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
                             case 5:
                                 if (member->canBorrow()) {
                                     handleReserveBook(library, userID);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
                             case 6:
                                 if (member->canBorrow()) {
                                     handleCancelReservation(library, userID);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
@@ -691,35 +738,35 @@ int main() {
                             case 10:
                                 if (member->canBorrow()) {
                                     handlePayFine(library, userID);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
                             case 11:
                                 if (member->canManageBooks()) {
                                     handleAddBook(library);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
                             case 12:
                                 if (member->canManageBooks()) {
                                     handleRemoveBook(library);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
                             case 13:
                                 if (member->canManageUsers()) {
                                     handleAddUser(library);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
                             case 14:
                                 if (member->canManageUsers()) {
                                     handleRemoveUser(library);
-                                    library.saveState();
+                                    library.checkpoint();
                                     waitForEnter();
                                 }
                                 break;
@@ -735,6 +782,12 @@ int main() {
                                     waitForEnter();
                                 }
                                 break;
+                            case 17:
+                                if (member->canManageUsers()) {
+                                    handleViewOverdueBooks(library);
+                                    waitForEnter();
+                                }
+                                break;
                             default: 
                                 cout << "Invalid choice!\n";
                                 waitForEnter();
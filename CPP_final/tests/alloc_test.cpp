@@ -0,0 +1,146 @@
+// Heap allocation test for the read and serialization paths. Exits non-zero
+// if any of them allocates per record.
+//
+//   alloc_test [books]                    default 20000 books
+//
+// Global operator new is replaced with one that counts calls. Field reads,
+// lookups and loan walks must not allocate at all. Paths that hand back a
+// result or write files may allocate a few buffers, so they are run on a
+// catalog and on one four times its size: the larger run may only add the
+// odd reallocation of a growing buffer, well under one per extra record.
+#include "../bench/bench_common.h"
+
+#include <atomic>
+#include <new>
+
+static atomic<size_t> heapAllocations{0};
+
+void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void* ptr = malloc(size ? size : 1)) return ptr;
+    throw bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+static int failures = 0;
+
+static void check(bool condition, const string& message) {
+    if (condition) return;
+    cerr << "FAIL: " << message << endl;
+    failures++;
+}
+
+// Heap allocations made by work().
+template<typename Work>
+static size_t allocationsDuring(Work&& work) {
+    size_t before = heapAllocations;
+    work();
+    return heapAllocations - before;
+}
+
+// Allocations the path makes per record, and the records it covered, on one
+// catalog size.
+struct PathCost {
+    size_t allocations = 0;
+    size_t records = 0;
+};
+
+static void checkPerRecord(const string& path, const PathCost& small, const PathCost& large) {
+    double perRecord = large.records > small.records
+        ? (static_cast<double>(large.allocations) - small.allocations) / (large.records - small.records)
+        : 0.0;
+    cout << path << ": " << small.allocations << " allocations for " << small.records << " records, "
+         << large.allocations << " for " << large.records << "\n";
+    check(large.records > small.records, path + " covered no extra records on the larger catalog");
+    check(perRecord < 0.01, path + " allocates " + to_string(perRecord) + " times per record");
+}
+
+// Runs the paths that may allocate a bounded number of buffers on a catalog
+// of the given size, which must be the only one in the process at the time.
+static void measureBufferedPaths(size_t bookCount, PathCost& search, PathCost& listing, PathCost& save) {
+    ScratchDirectory scratch;
+    Library library;
+    library.setJournaling(false);
+    fillCatalog(library, bookCount);
+    fillUsers(library, bookCount / 10);
+
+    // A one-word and a two-word query. Their postings lists grow with the
+    // catalog, so search is charged per book rather than per hit.
+    size_t hits = 0;
+    search.allocations = allocationsDuring([&] {
+        hits += library.searchBooks("river").size();
+        hits += library.searchBooks("palace guide").size();
+    });
+    search.records = hits > 0 ? bookCount : 0;
+    listing.allocations = allocationsDuring([&] { listing.records = library.listBooks(0, bookCount).books.size(); });
+    save.allocations = allocationsDuring([&] { library.saveState(); });
+    save.records = library.getBookCount() + library.getUserCount();
+}
+
+int main(int argc, char* argv[]) {
+    size_t bookCount = argOr(argc, argv, 1, 20000);
+    size_t userCount = bookCount / 10;
+
+    {
+        ScratchDirectory scratch;
+        Library library;
+        fillCatalog(library, bookCount);
+        fillUsers(library, userCount);
+        for (size_t i = 0; i < userCount; i++) library.borrowBook(100000 + static_cast<int>(i), static_cast<int>(i + 1));
+
+        size_t fieldBytes = 0;
+        size_t bookReads = allocationsDuring([&] {
+            for (size_t id = 1; id <= bookCount; id++) {
+                const Book* book = library.getBook(static_cast<int>(id));
+                fieldBytes += book->getTitle().size() + book->getAuthor().size() + book->getPublisher().size() +
+                              book->getISBN().size() + book->isAvailable();
+            }
+        });
+        check(bookReads == 0, "reading book fields made " + to_string(bookReads) + " allocations");
+
+        size_t memberReads = allocationsDuring([&] {
+            for (size_t i = 0; i < userCount; i++) {
+                const Member* user = library.getMember(100000 + static_cast<int>(i));
+                fieldBytes += user->getName().size() + user->getRole().size() + user->getDepartment().size() +
+                              user->getPassword().size();
+            }
+        });
+        check(memberReads == 0, "reading member fields made " + to_string(memberReads) + " allocations");
+
+        size_t isbnLookups = allocationsDuring([&] {
+            for (size_t id = 1; id <= bookCount; id += 97) {
+                fieldBytes += library.findBookByISBN(library.getBook(static_cast<int>(id))->getISBN()) != nullptr;
+            }
+        });
+        check(isbnLookups == 0, "ISBN lookups made " + to_string(isbnLookups) + " allocations");
+
+        size_t loans = 0;
+        size_t loanReads = allocationsDuring([&] {
+            for (size_t id = 1; id <= bookCount; id++) loans += library.findLoan(static_cast<int>(id)).has_value();
+            library.forEachLoan([&](const Book& book, const Member& user, const LoanSummary&) {
+                fieldBytes += book.getTitle().size() + user.getName().size();
+            });
+        });
+        check(loans == userCount, "expected " + to_string(userCount) + " loans, found " + to_string(loans));
+        check(loanReads == 0, "loan lookups made " + to_string(loanReads) + " allocations");
+
+        cout << "Field reads, ISBN and loan lookups: " << bookReads + memberReads + isbnLookups + loanReads
+             << " allocations (" << fieldBytes << " bytes read)\n";
+    }
+
+    PathCost smallSearch, smallListing, smallSave, largeSearch, largeListing, largeSave;
+    measureBufferedPaths(bookCount, smallSearch, smallListing, smallSave);
+    measureBufferedPaths(4 * bookCount, largeSearch, largeListing, largeSave);
+    checkPerRecord("searchBooks", smallSearch, largeSearch);
+    checkPerRecord("listBooks", smallListing, largeListing);
+    checkPerRecord("saveState", smallSave, largeSave);
+
+    if (failures > 0) {
+        cerr << failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "OK" << endl;
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Replays a journal over data files that already include its effects and
+// checks that the library comes back as it was. Exits non-zero on a mismatch.
+//
+//   replay_test [rounds]                  default 200 random rounds
+//
+// Each round runs a script of borrows, returns, reservations and
+// cancellations with journaling on, then checkpoints. The records the
+// checkpoint covered are put back in journal.old, as if the process had died
+// before deleting it:
+// - after data/checkpoint.txt was updated, so that replay should skip them;
+//   everything, borrowing history included, must match.
+// - before it was updated, so that they are replayed over the new files;
+//   loans and reservations must still match.
+#include "../bench/bench_common.h"
+
+#include <fstream>
+#include <sstream>
+
+static int failures = 0;
+
+static void check(bool condition, const string& message) {
+    if (condition) return;
+    cerr << "FAIL: " << message << endl;
+    failures++;
+}
+
+enum class OpType { Borrow, Return, Reserve, Cancel };
+
+struct Op {
+    OpType type;
+    int userID;
+    int bookID;
+};
+
+static const int BOOK_COUNT = 3;
+static const int USER_COUNT = 4;
+static const int FIRST_USER = 100000;
+
+static void run(Library& library, const Op& op) {
+    switch (op.type) {
+    case OpType::Borrow:
+        library.borrowBook(op.userID, op.bookID);
+        break;
+    case OpType::Return:
+        // Whoever has it, so that returns happen whatever the script's guess.
+        if (auto loan = library.findLoan(op.bookID)) library.returnBook(loan->userID, op.bookID);
+        break;
+    case OpType::Reserve:
+        library.reserveBook(op.userID, op.bookID);
+        break;
+    case OpType::Cancel:
+        library.cancelReservation(op.userID, op.bookID);
+        break;
+    }
+}
+
+// One line per user with their loans and reservations, and with history
+// length and fine balance too when withHistory is set.
+static string describe(const Library& library, bool withHistory) {
+    ostringstream out;
+    for (int userID = FIRST_USER; userID < FIRST_USER + USER_COUNT; userID++) {
+        out << userID << " holds";
+        for (int bookID = 1; bookID <= BOOK_COUNT; bookID++) {
+            auto loan = library.findLoan(bookID);
+            if (loan && loan->userID == userID) out << " " << bookID;
+        }
+        out << ", reserved";
+        for (const Book* book : library.getReservedBooks(userID)) out << " " << book->getBookID();
+        if (withHistory) {
+            out << ", " << library.getAccount(userID)->getBorrowHistory().size() << " returned, fine "
+                << library.getOutstandingFine(userID);
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+static bool readFile(const string& path, string& content) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) return false;
+    content.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    return true;
+}
+
+static void writeFile(const string& path, const string& content) {
+    ofstream file(path, ios::binary | ios::trunc);
+    file << content;
+}
+
+static void checkScript(const string& name, const vector<Op>& script) {
+    for (bool checkpointRecorded : {true, false}) {
+        ScratchDirectory scratch;
+        string expected, records, sequence;
+        {
+            Library live;
+            fillCatalog(live, BOOK_COUNT);
+            fillUsers(live, USER_COUNT);
+            live.saveState();
+            live.setJournaling(true);
+            for (const Op& op : script) run(live, op);
+            live.sync();
+            readFile("data/journal.txt", records);
+
+            string previous;
+            readFile("data/checkpoint.txt", previous);
+            live.saveState();
+            readFile("data/checkpoint.txt", sequence);
+            writeFile("data/journal.old", records + "CHECKPOINT|" + sequence);
+            if (!checkpointRecorded) writeFile("data/checkpoint.txt", previous);
+            expected = describe(live, checkpointRecorded);
+        }
+
+        Library recovered;
+        recovered.loadState();
+        string actual = describe(recovered, checkpointRecorded);
+        check(actual == expected, name + (checkpointRecorded ? ", checkpoint recorded" : ", checkpoint not recorded") +
+                                      ":\nexpected\n" + expected + "got\n" + actual);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t rounds = argOr(argc, argv, 1, 200);
+    const int a = FIRST_USER, b = FIRST_USER + 1, c = FIRST_USER + 2;
+
+    checkScript("hand-off", {{OpType::Borrow, a, 1}, {OpType::Reserve, b, 1}, {OpType::Return, a, 1}});
+    checkScript("hand-off, then a third borrower",
+                {{OpType::Borrow, a, 1}, {OpType::Reserve, b, 1}, {OpType::Return, a, 1},
+                 {OpType::Return, b, 1}, {OpType::Borrow, c, 1}});
+    checkScript("cancelled reservation",
+                {{OpType::Borrow, a, 1}, {OpType::Reserve, b, 1}, {OpType::Cancel, b, 1}, {OpType::Return, a, 1}});
+
+    mt19937 rng(1);
+    for (size_t round = 0; round < rounds; round++) {
+        vector<Op> script;
+        for (int step = 0; step < 12; step++) {
+            script.push_back({static_cast<OpType>(rng() % 4), FIRST_USER + static_cast<int>(rng() % USER_COUNT),
+                              1 + static_cast<int>(rng() % BOOK_COUNT)});
+        }
+        checkScript("random round " + to_string(round + 1), script);
+    }
+
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
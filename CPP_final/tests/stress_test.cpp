@@ -0,0 +1,226 @@
+// Concurrency stress test for Library. Meant to be built with
+// -fsanitize=thread; exits non-zero if an invariant is broken.
+//
+//   stress_test [threads] [seconds]       default 8 threads for 5 seconds
+//
+// Worker threads borrow, return, reserve and cancel on a small catalog so
+// that they keep colliding on the same books and accounts, while others
+// search, list loans and checkpoint; no checkpoint, addBook or removeBook may
+// wait more than two seconds for them. Afterwards every loan must be held by
+// exactly one account, every account must be within its borrowing limit, and
+// the loan table must match the accounts.
+//
+// A second round has threads return and borrow the same few books with no
+// checkpoints. The library is then dropped without saving, as in a crash, and
+// a fresh one rebuilt from the files and the journal must have the same loans,
+// and each book's BORROW and RETURN records must alternate in the journal.
+#include "../bench/bench_common.h"
+
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool condition, const string& message) {
+    if (condition) return;
+    cerr << "FAIL: " << message << endl;
+    failures++;
+}
+
+// Walks the journal of a round that started with nothing on loan and counts
+// records replay would skip: a BORROW of a book already out, or a RETURN
+// by someone other than its holder.
+static size_t outOfOrderRecords(int bookCount) {
+    ifstream journal("data/journal.txt");
+    vector<int> holders(bookCount + 1, -1);
+    size_t outOfOrder = 0;
+    string line;
+    while (getline(journal, line)) {
+        RecordFields parts(line, '|');
+        int userID, bookID;
+        if (parts.size() < 3 || !parts.tryNumber(1, userID) || !parts.tryNumber(2, bookID)) continue;
+        if (bookID < 1 || bookID > bookCount) continue;
+        if (parts[0] == "BORROW") {
+            outOfOrder += holders[bookID] != -1;
+            holders[bookID] = userID;
+        } else if (parts[0] == "RETURN") {
+            outOfOrder += holders[bookID] != userID;
+            holders[bookID] = -1;
+        }
+    }
+    return outOfOrder;
+}
+
+// Loads the data directory into a new library, as a restart after a crash
+// would, and checks that it has the same loans as the one that wrote it.
+static void checkRecovery(Library& library, int bookCount, const string& round) {
+    library.sync();
+    Library recovered;
+    recovered.loadState();
+    for (int bookID = 1; bookID <= bookCount; bookID++) {
+        auto loan = library.findLoan(bookID);
+        auto recoveredLoan = recovered.findLoan(bookID);
+        check(loan.has_value() == recoveredLoan.has_value() && (!loan || loan->userID == recoveredLoan->userID),
+              round + ": book " + to_string(bookID) + " has a different borrower after recovery");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t threadCount = argOr(argc, argv, 1, 8);
+    size_t seconds = argOr(argc, argv, 2, 5);
+    const int bookCount = 400;
+    const int userCount = 64;
+    ScratchDirectory scratch;
+
+    Library library;
+    fillCatalog(library, bookCount);
+    for (int i = 0; i < userCount; i++) {
+        int id = 100000 + i;
+        if (i % 4 == 0) {
+            library.addUser(make_unique<Professor>(id, "Professor " + to_string(id), "pw"));
+        } else {
+            library.addUser(make_unique<Student>(id, "Student " + to_string(id), "pw"));
+        }
+    }
+
+    // Journaled, so that checkpoints past the first thousand records compact
+    // while the workers keep going.
+    library.setJournaling(true);
+
+    atomic<bool> stop{false};
+    atomic<long> borrows{0}, returns{0}, reads{0}, checkpoints{0};
+    vector<thread> threads;
+    for (size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            mt19937 rng(static_cast<unsigned>(t) + 1);
+            while (!stop) {
+                int userID = 100000 + rng() % userCount;
+                int bookID = 1 + rng() % bookCount;
+                switch (rng() % 8) {
+                case 0:
+                case 1:
+                case 2:
+                    if (library.borrowBook(userID, bookID)) borrows++;
+                    break;
+                case 3:
+                case 4:
+                    // Return whoever holds it, racing the holder's own thread.
+                    if (auto loan = library.findLoan(bookID)) {
+                        if (library.returnBook(loan->userID, bookID)) returns++;
+                    }
+                    break;
+                case 5:
+                    if (!library.reserveBook(userID, bookID)) library.cancelReservation(userID, bookID);
+                    break;
+                case 6:
+                    library.searchBooks(TITLE_WORDS[rng() % 10]);
+                    library.getBook(bookID);
+                    reads++;
+                    break;
+                default:
+                    library.getAllBorrowedBooks(LoanOrder::ByDueDate);
+                    reads++;
+                    break;
+                }
+            }
+        });
+    }
+    // Exclusive operations must get through the steady stream of readers, so
+    // each one is timed.
+    double slowestExclusive = 0.0;
+    threads.emplace_back([&] {
+        for (int spareID = bookCount + 1; !stop; spareID++) {
+            auto start = chrono::steady_clock::now();
+            library.checkpoint();
+            slowestExclusive = max(slowestExclusive, secondsSince(start));
+            checkpoints++;
+
+            start = chrono::steady_clock::now();
+            library.addBook(make_unique<Book>(spareID, "Spare", "Author", "Publisher", 2000, ""));
+            library.removeBook(spareID);
+            slowestExclusive = max(slowestExclusive, secondsSince(start));
+            this_thread::sleep_for(chrono::milliseconds(50));
+        }
+    });
+
+    this_thread::sleep_for(chrono::seconds(seconds));
+    stop = true;
+    for (auto& worker : threads) worker.join();
+
+    check(slowestExclusive < 2.0, "an exclusive operation waited " + to_string(slowestExclusive) + " s for the readers");
+
+    map<int, int> holders;
+    for (int i = 0; i < userCount; i++) {
+        int userID = 100000 + i;
+        const Account* account = library.getAccount(userID);
+        const Member* member = library.getMember(userID);
+        check(account && member, "user " + to_string(userID) + " lost");
+        if (!account || !member) continue;
+        check(static_cast<int>(account->getCurrentBorrows().size()) <= member->getMaxBooks(),
+              "user " + to_string(userID) + " is over the borrowing limit");
+        for (const BorrowRecord& record : account->getCurrentBorrows()) {
+            check(holders.emplace(record.bookID, userID).second,
+                  "book " + to_string(record.bookID) + " is loaned twice");
+        }
+    }
+
+    size_t loans = 0;
+    for (int bookID = 1; bookID <= bookCount; bookID++) {
+        const Book* book = library.getBook(bookID);
+        auto loan = library.findLoan(bookID);
+        auto holder = holders.find(bookID);
+        bool loaned = book->getState() == BookState::Loaned;
+        loans += loaned;
+        check(loaned == (holder != holders.end()), "book " + to_string(bookID) + " state disagrees with the accounts");
+        check(loaned == loan.has_value(), "book " + to_string(bookID) + " state disagrees with the loan table");
+        if (loaned && holder != holders.end() && loan) {
+            check(book->getHolder() == holder->second && loan->userID == holder->second,
+                  "book " + to_string(bookID) + " has conflicting borrowers");
+        }
+    }
+    check(library.getAllBorrowedBooks().size() == loans, "loan table size disagrees with the books");
+    checkRecovery(library, bookCount, "after the mixed round");
+
+    // Every thread returns whatever is out among four hot books and borrows
+    // them back, so a return and the next borrow of a book keep racing.
+    const int hotBooks = 4;
+    long handoffs = 0;
+    {
+        ScratchDirectory hotScratch;
+        Library hot;
+        fillCatalog(hot, hotBooks);
+        fillUsers(hot, threadCount);
+        hot.saveState();
+        hot.setJournaling(true);
+        atomic<long> claims{0};
+        stop = false;
+        threads.clear();
+        for (size_t t = 0; t < threadCount; t++) {
+            threads.emplace_back([&, t] {
+                int userID = 100000 + static_cast<int>(t);
+                for (unsigned round = 0; !stop; round++) {
+                    int bookID = 1 + static_cast<int>((t + round) % hotBooks);
+                    if (auto loan = hot.findLoan(bookID)) hot.returnBook(loan->userID, bookID);
+                    if (hot.borrowBook(userID, bookID)) claims++;
+                }
+            });
+        }
+        this_thread::sleep_for(chrono::seconds(1));
+        stop = true;
+        for (auto& worker : threads) worker.join();
+        handoffs = claims;
+        hot.sync();
+        size_t outOfOrder = outOfOrderRecords(hotBooks);
+        check(outOfOrder == 0, to_string(outOfOrder) + " journal records out of order after the hand-off round");
+        checkRecovery(hot, hotBooks, "after the hand-off round");
+    }
+
+    cout << threadCount << " threads, " << seconds << " s: " << borrows << " borrows, " << returns << " returns, "
+         << reads << " reads, " << checkpoints << " checkpoints (slowest exclusive operation "
+         << slowestExclusive * 1000 << " ms), " << loans << " books on loan at the end, "
+         << handoffs << " hand-off borrows\n";
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
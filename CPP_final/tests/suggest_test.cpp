@@ -0,0 +1,121 @@
+// Ranking test for type-ahead completion. Exits non-zero if a completion list
+// differs from the one worked out by brute force.
+//
+//   suggest_test [rounds]                 default 20000 random operations
+//
+// A library with a few prolific authors must suggest them before the rest.
+// Then a PrefixIndex gets random adds and removes of short keys over a small
+// alphabet, so that short prefixes match well over the keys a ranking is kept
+// for, and every lookup must list the most shared keys first and break ties
+// alphabetically, whatever rankings earlier lookups kept.
+#include "../bench/bench_common.h"
+
+#include <algorithm>
+#include <map>
+
+static int failures = 0;
+
+static void check(bool condition, const string& message) {
+    if (condition) return;
+    cerr << "FAIL: " << message << endl;
+    failures++;
+}
+
+static string joined(const vector<string>& items) {
+    string out;
+    for (const string& item : items) out += (out.empty() ? "" : ", ") + item;
+    return out;
+}
+
+static void checkAuthors() {
+    ScratchDirectory scratch;
+    Library library;
+    library.setJournaling(false);
+    int bookID = 1;
+    auto addBooks = [&](const string& author, int count) {
+        for (int i = 0; i < count; i++, bookID++) {
+            library.addBook(make_unique<Book>(bookID, "Title " + to_string(bookID), author, "Publisher", 2000,
+                                              "978-" + to_string(bookID)));
+        }
+    };
+    addBooks("Amitav Ghosh", 2);
+    addBooks("Anita Desai", 5);
+    addBooks("Arundhati Roy", 3);
+    addBooks("Aravind Adiga", 1);
+
+    vector<string> expected = {"Anita Desai", "Arundhati Roy", "Amitav Ghosh"};
+    vector<string> actual = library.suggest("A", 3);
+    check(actual == expected, "suggest(\"A\") gave " + joined(actual) + ", expected " + joined(expected));
+
+    // Two more Ghosh books overtake Roy; removing three of Desai's drops her
+    // below both.
+    addBooks("Amitav Ghosh", 2);
+    for (int id = 3; id <= 5; id++) library.removeBook(id);
+    expected = {"Amitav Ghosh", "Arundhati Roy", "Anita Desai", "Aravind Adiga"};
+    actual = library.suggest("a", 4);
+    check(actual == expected, "after changes suggest(\"a\") gave " + joined(actual) + ", expected " + joined(expected));
+}
+
+// The first limit keys starting with prefix, most shared first.
+static vector<string> bruteForce(const map<string, int>& counts, const string& prefix, size_t limit) {
+    vector<pair<string, int>> matches;
+    for (const auto& entry : counts) {
+        if (entry.first.compare(0, prefix.size(), prefix) == 0) matches.push_back(entry);
+    }
+    stable_sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    vector<string> top;
+    for (size_t i = 0; i < matches.size() && i < limit; i++) top.push_back(matches[i].first);
+    return top;
+}
+
+static void checkRandom(size_t rounds) {
+    // Keys of one to four words of one to three letters from "abc", so that
+    // "a" alone starts a few hundred of them.
+    mt19937 rng(3);
+    auto randomKey = [&rng]() {
+        string key;
+        for (int words = 1 + rng() % 4; words > 0; words--) {
+            if (!key.empty()) key += ' ';
+            for (int letters = 1 + rng() % 3; letters > 0; letters--) key += static_cast<char>('a' + rng() % 3);
+        }
+        return key;
+    };
+    static const size_t limits[] = {1, 3, 10, 64, 100};
+
+    PrefixIndex index;
+    map<string, int> counts;
+    vector<string> initial;
+    for (int i = 0; i < 2000; i++) initial.push_back(randomKey());
+    index.build(vector<string_view>(initial.begin(), initial.end()));
+    for (const string& key : initial) counts[key]++;
+
+    for (size_t round = 0; round < rounds; round++) {
+        unsigned op = rng() % 10;
+        if (op < 3) {
+            string key = randomKey();
+            index.add(key);
+            counts[key]++;
+        } else if (op < 5 && !counts.empty()) {
+            auto it = next(counts.begin(), rng() % counts.size());
+            index.remove(it->first);
+            if (--it->second == 0) counts.erase(it);
+        } else {
+            string prefix = randomKey().substr(0, 1 + rng() % 4);
+            size_t limit = limits[rng() % 5];
+            vector<string> expected = bruteForce(counts, prefix, limit);
+            vector<string> actual = index.complete(prefix, limit);
+            check(actual == expected, "round " + to_string(round) + ": complete(\"" + prefix + "\", " +
+                                          to_string(limit) + ") gave " + joined(actual) + ", expected " +
+                                          joined(expected));
+            if (failures > 10) return;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t rounds = argOr(argc, argv, 1, 20000);
+    checkAuthors();
+    checkRandom(rounds);
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}